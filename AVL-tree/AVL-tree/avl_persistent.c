@@ -0,0 +1,314 @@
+//
+//  avl_persistent.c
+//  AVL-tree
+//
+//  Path-copying AVL tree with epoch reclaimed versions, see
+//  avl_persistent.h.
+//
+
+#include <stdlib.h>
+#include "avl_persistent.h"
+
+#define AVL_PTREE_RECLAIM_BATCH 16      /* writes between reclaim attempts */
+#define AVL_PTREE_MAX_SPARE     4096    /* reclaimed nodes kept for reuse */
+
+/* one write in progress, under the lock */
+typedef struct {
+    avl_ptree *t;
+    unsigned long stamp;
+    avl_pretired *batch;
+} avl_pwrite;
+
+avl_ptree *avl_ptree_create(cmp_func compare) {
+    avl_ptree *t;
+    if (posix_memalign((void **)&t, AVL_PTREE_CACHE_LINE, sizeof(avl_ptree)) != 0) {
+        return NULL;
+    }
+    t->root = NULL;
+    t->compare = compare;
+    pthread_mutex_init(&t->lock, NULL);
+    t->stamp = 0;
+    t->count = 0;
+    t->spare = NULL;
+    t->sparecount = 0;
+    epoch_init(&t->readers, AVL_PTREE_RECLAIM_BATCH);
+    return t;
+}
+
+const avl_pnode *avl_ptree_snapshot(avl_ptree *t) {
+    epoch_pin(&t->readers);
+    return __atomic_load_n(&t->root, __ATOMIC_ACQUIRE);
+}
+
+void avl_ptree_release(avl_ptree *t) {
+    epoch_unpin(&t->readers);
+}
+
+void *avl_ptree_lookup(const avl_pnode *root, void *value, cmp_func compare) {
+    int result;
+    while (root != NULL) {
+        result = compare(value, root->data);
+        if (result == 0) {
+            return root->data;
+        }
+        root = result > 0 ? root->right : root->left;
+    }
+    return NULL;
+}
+
+unsigned int avl_ptree_foreach(const avl_pnode *root, void (*fn)(void *ctx, void *value), void *ctx) {
+    unsigned int count = 0;
+    for (; root != NULL; root = root->right) {
+        count += avl_ptree_foreach(root->left, fn, ctx);
+        fn(ctx, root->data);
+        count++;
+    }
+    return count;
+}
+
+unsigned int avl_ptree_count(avl_ptree *t) {
+    return __atomic_load_n(&t->count, __ATOMIC_RELAXED);
+}
+
+static void avl_ptree_free_spare(avl_ptree *t, avl_pnode *n) {
+    if (t->sparecount < AVL_PTREE_MAX_SPARE) {
+        n->left = t->spare;
+        t->spare = n;
+        t->sparecount++;
+    }
+    else {
+        free(n);
+    }
+}
+
+/* epoch_free_fn for one write's batch. Only writers retire, with the
+ * lock held, so the nodes can go straight back to the cache. */
+static void avl_ptree_free_batch(void *ctx, void *ptr) {
+    avl_pretired *r = (avl_pretired *)ptr;
+    unsigned int i;
+    for (i = 0; i < r->count; i++) {
+        avl_ptree_free_spare((avl_ptree *)ctx, r->nodes[i]);
+    }
+    free(r);
+}
+
+/* Makes sure the write can not run out of nodes halfway: a path copy plus
+ * a rotation copy per level, and one new node. */
+static int avl_ptree_begin(avl_ptree *t, avl_pwrite *w) {
+    unsigned int need = 3 * (unsigned int)((t->root ? t->root->height : 0) + 1) + 1;
+    avl_pnode *n;
+    while (t->sparecount < need) {
+        if ((n = (avl_pnode *)malloc(sizeof(avl_pnode))) == NULL) {
+            return 0;
+        }
+        n->left = t->spare;
+        t->spare = n;
+        t->sparecount++;
+    }
+    w->batch = (avl_pretired *)malloc(sizeof(avl_pretired) + need * sizeof(avl_pnode *));
+    if (w->batch == NULL) {
+        return 0;
+    }
+    w->batch->count = 0;
+    w->t = t;
+    w->stamp = ++t->stamp;
+    return -1;
+}
+
+/* publishes 'root' as the new version and retires what it replaced */
+static void avl_ptree_commit(avl_pwrite *w, avl_pnode *root) {
+    avl_ptree *t = w->t;
+    __atomic_store_n(&t->root, root, __ATOMIC_RELEASE);
+    if (w->batch->count == 0) {
+        free(w->batch);
+        return;
+    }
+    epoch_retire(&t->readers, w->batch, avl_ptree_free_batch, t);
+}
+
+static int avl_pheight(const avl_pnode *n) {
+    return n == NULL ? 0 : n->height;
+}
+
+static void avl_pupdate(avl_pnode *n) {
+    int l = avl_pheight(n->left), r = avl_pheight(n->right);
+    n->height = 1 + (l >= r ? l : r);
+}
+
+static avl_pnode *avl_pnode_new(avl_pwrite *w, void *data, avl_pnode *left, avl_pnode *right) {
+    avl_pnode *n = w->t->spare;
+    w->t->spare = n->left;
+    w->t->sparecount--;
+    n->data = data;
+    n->left = left;
+    n->right = right;
+    n->stamp = w->stamp;
+    avl_pupdate(n);
+    return n;
+}
+
+/* n leaves the tree: straight back to the cache if no reader ever saw it */
+static void avl_pretire(avl_pwrite *w, avl_pnode *n) {
+    if (n->stamp == w->stamp) {
+        avl_ptree_free_spare(w->t, n);
+    }
+    else {
+        w->batch->nodes[w->batch->count++] = n;
+    }
+}
+
+/* n itself if this write created it, else a private copy */
+static avl_pnode *avl_pmutable(avl_pwrite *w, avl_pnode *n) {
+    avl_pnode *m;
+    if (n->stamp == w->stamp) {
+        return n;
+    }
+    m = avl_pnode_new(w, n->data, n->left, n->right);
+    avl_pretire(w, n);
+    return m;
+}
+
+/* n must be private; its left child is copied if it is shared */
+static avl_pnode *avl_protate_right(avl_pwrite *w, avl_pnode *n) {
+    avl_pnode *pivot = avl_pmutable(w, n->left);
+    n->left = pivot->right;
+    pivot->right = n;
+    avl_pupdate(n);
+    avl_pupdate(pivot);
+    return pivot;
+}
+
+static avl_pnode *avl_protate_left(avl_pwrite *w, avl_pnode *n) {
+    avl_pnode *pivot = avl_pmutable(w, n->right);
+    n->right = pivot->left;
+    pivot->left = n;
+    avl_pupdate(n);
+    avl_pupdate(pivot);
+    return pivot;
+}
+
+/* avl_tree_balance on a private node; returns the subtree's new root */
+static avl_pnode *avl_pbalance(avl_pwrite *w, avl_pnode *n) {
+    int factor;
+    avl_pupdate(n);
+    factor = avl_pheight(n->left) - avl_pheight(n->right);
+    if (factor == 2) {
+        if (avl_pheight(n->left->left) < avl_pheight(n->left->right)) {
+            n->left = avl_protate_left(w, avl_pmutable(w, n->left));
+        }
+        return avl_protate_right(w, n);
+    }
+    if (factor == -2) {
+        if (avl_pheight(n->right->right) < avl_pheight(n->right->left)) {
+            n->right = avl_protate_right(w, avl_pmutable(w, n->right));
+        }
+        return avl_protate_left(w, n);
+    }
+    return n;
+}
+
+/* the value must not be in n's subtree yet */
+static avl_pnode *avl_pinsert(avl_pwrite *w, avl_pnode *n, void *value) {
+    if (n == NULL) {
+        return avl_pnode_new(w, value, NULL, NULL);
+    }
+    n = avl_pmutable(w, n);
+    if (w->t->compare(value, n->data) > 0) {
+        n->right = avl_pinsert(w, n->right, value);
+    }
+    else {
+        n->left = avl_pinsert(w, n->left, value);
+    }
+    return avl_pbalance(w, n);
+}
+
+/* n's subtree without its minimum, whose value goes to *data */
+static avl_pnode *avl_pdelete_min(avl_pwrite *w, avl_pnode *n, void **data) {
+    avl_pnode *right;
+    if (n->left == NULL) {
+        *data = n->data;
+        right = n->right;
+        avl_pretire(w, n);
+        return right;
+    }
+    n = avl_pmutable(w, n);
+    n->left = avl_pdelete_min(w, n->left, data);
+    return avl_pbalance(w, n);
+}
+
+/* the value must be in n's subtree */
+static avl_pnode *avl_pdelete(avl_pwrite *w, avl_pnode *n, void *value) {
+    avl_pnode *left, *right;
+    void *data;
+    int result = w->t->compare(value, n->data);
+    if (result == 0) {
+        left = n->left;
+        right = n->right;
+        avl_pretire(w, n);
+        if (left == NULL || right == NULL) {
+            return left != NULL ? left : right;
+        }
+        right = avl_pdelete_min(w, right, &data);
+        return avl_pbalance(w, avl_pnode_new(w, data, left, right));
+    }
+    n = avl_pmutable(w, n);
+    if (result > 0) {
+        n->right = avl_pdelete(w, n->right, value);
+    }
+    else {
+        n->left = avl_pdelete(w, n->left, value);
+    }
+    return avl_pbalance(w, n);
+}
+
+int avl_ptree_insert(avl_ptree *t, void *value) {
+    avl_pwrite w;
+    pthread_mutex_lock(&t->lock);
+    if (avl_ptree_lookup(t->root, value, t->compare) != NULL) {
+        pthread_mutex_unlock(&t->lock);
+        return -1;
+    }
+    if (!avl_ptree_begin(t, &w)) {
+        pthread_mutex_unlock(&t->lock);
+        return 0;
+    }
+    avl_ptree_commit(&w, avl_pinsert(&w, t->root, value));
+    __atomic_store_n(&t->count, t->count + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&t->lock);
+    return -1;
+}
+
+int avl_ptree_delete(avl_ptree *t, void *value) {
+    avl_pwrite w;
+    pthread_mutex_lock(&t->lock);
+    if (avl_ptree_lookup(t->root, value, t->compare) == NULL || !avl_ptree_begin(t, &w)) {
+        pthread_mutex_unlock(&t->lock);
+        return 0;
+    }
+    avl_ptree_commit(&w, avl_pdelete(&w, t->root, value));
+    __atomic_store_n(&t->count, t->count - 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&t->lock);
+    return -1;
+}
+
+static void avl_ptree_free_nodes(avl_pnode *n) {
+    avl_pnode *right;
+    for (; n != NULL; n = right) {
+        avl_ptree_free_nodes(n->left);
+        right = n->right;
+        free(n);
+    }
+}
+
+void avl_ptree_destroy(avl_ptree *t) {
+    avl_pnode *n, *next;
+    avl_ptree_free_nodes(t->root);
+    t->sparecount = AVL_PTREE_MAX_SPARE;    // free, do not cache
+    epoch_destroy(&t->readers);
+    for (n = t->spare; n != NULL; n = next) {
+        next = n->left;
+        free(n);
+    }
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
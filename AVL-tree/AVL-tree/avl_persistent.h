@@ -0,0 +1,78 @@
+//
+//  avl_persistent.h
+//  AVL-tree
+//
+//  Persistent AVL tree for point-in-time views under concurrent writes.
+//  A write never touches a published node. It copies the path it changes
+//  (and whatever a rotation moves off that path), then publishes the new
+//  root with one atomic store. Every root ever published is thus an
+//  immutable snapshot, and readers walk one without any lock. Writers
+//  serialize on a mutex.
+//
+//  Nodes have no parent link, since a shared subtree has many parents. A
+//  node a write replaced stays readable until every reader pinned at the
+//  time has released its snapshot (epoch based, see common/epoch.h); only
+//  then is it reused or freed.
+//
+
+#ifndef AVL_tree_avl_persistent_h
+#define AVL_tree_avl_persistent_h
+
+#include <pthread.h>
+#include "avl_tree.h"
+#include "../../common/epoch.h"
+
+#define AVL_PTREE_CACHE_LINE    64
+
+typedef struct avl_pnode {
+    void *data;
+    struct avl_pnode *left;
+    struct avl_pnode *right;
+    int height;
+    unsigned long stamp;        /* the write that created it */
+} avl_pnode;
+
+/* nodes one write took out of the tree, retired together */
+typedef struct {
+    unsigned int count;
+    avl_pnode *nodes[];
+} avl_pretired;
+
+typedef struct {
+    avl_pnode *root;                    /* the current version, atomic */
+    cmp_func compare;
+    pthread_mutex_t lock;               /* writers; everything below is theirs */
+    unsigned long stamp;
+    unsigned int count;
+    avl_pnode *spare;                   /* node cache, linked through 'left' */
+    unsigned int sparecount;
+    epoch_domain readers;               /* retires under 'lock' too */
+} avl_ptree;
+
+avl_ptree *avl_ptree_create(cmp_func compare);
+
+/* -1 when inserted or already present, 0 when out of memory (the tree is
+ * then unchanged) */
+int avl_ptree_insert(avl_ptree *t, void *value);
+
+/* -1 when removed, 0 when absent or out of memory */
+int avl_ptree_delete(avl_ptree *t, void *value);
+
+/* Pins the calling thread and returns the current version's root (NULL
+ * when empty). That version stays intact until the matching release, even
+ * as writers move on. Snapshots nest. */
+const avl_pnode *avl_ptree_snapshot(avl_ptree *t);
+void avl_ptree_release(avl_ptree *t);
+
+/* reads of a snapshot; they need no lock */
+void *avl_ptree_lookup(const avl_pnode *root, void *value, cmp_func compare);
+/* calls fn(ctx, value) in order, returns how many */
+unsigned int avl_ptree_foreach(const avl_pnode *root, void (*fn)(void *ctx, void *value), void *ctx);
+
+/* node count of the current version */
+unsigned int avl_ptree_count(avl_ptree *t);
+
+/* no other thread may use the tree any more; values are not freed */
+void avl_ptree_destroy(avl_ptree *t);
+
+#endif
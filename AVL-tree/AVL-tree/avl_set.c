@@ -0,0 +1,196 @@
+//
+//  avl_set.c
+//  AVL-tree
+//
+//  Join-based set operations on a fork-join pool, see avl_set.h.
+//
+
+#include <stdlib.h>
+#include "avl_set.h"
+
+#define AVL_SET_GRAIN_HEIGHT    12      /* fork only when both halves are taller */
+
+enum { AVL_TASK_QUEUED, AVL_TASK_RUNNING, AVL_TASK_DONE };
+enum { AVL_UNION, AVL_INTERSECTION, AVL_DIFFERENCE };
+
+typedef struct {
+    avl_pool *pool;
+    cmp_func compare;
+    int op;
+    avl_node_t a;
+    avl_node_t b;
+    avl_node_t result;
+} avl_setop;
+
+/* called and returns with the lock held */
+static void avl_pool_run(avl_pool *pool, avl_task *task) {
+    task->state = AVL_TASK_RUNNING;
+    pthread_mutex_unlock(&pool->lock);
+    task->fn(task->arg);
+    pthread_mutex_lock(&pool->lock);
+    task->state = AVL_TASK_DONE;
+    pthread_cond_signal(&task->done);   // only the forking thread waits on it
+}
+
+static void *avl_pool_worker(void *arg) {
+    avl_pool *pool = (avl_pool *)arg;
+    avl_task *task;
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        if ((task = pool->queue) == NULL) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+        pool->queue = task->next;
+        avl_pool_run(pool, task);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+avl_pool *avl_pool_create(unsigned int threads) {
+    avl_pool *pool = (avl_pool *)malloc(sizeof(avl_pool));
+    unsigned int i;
+    if (pool == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pool->queue = NULL;
+    pool->stop = 0;
+    pool->nthreads = 0;
+    for (i = 0; i < threads && i < AVL_SET_MAX_THREADS; i++) {
+        if (pthread_create(&pool->threads[i], NULL, avl_pool_worker, pool) != 0) {
+            break;
+        }
+        pool->nthreads++;
+    }
+    if (pool->nthreads == 0 && threads > 0) {
+        avl_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void avl_pool_destroy(avl_pool *pool) {
+    unsigned int i;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    free(pool);
+}
+
+static void avl_pool_fork(avl_pool *pool, avl_task *task) {
+    pthread_cond_init(&task->done, NULL);
+    pthread_mutex_lock(&pool->lock);
+    task->state = AVL_TASK_QUEUED;
+    task->next = pool->queue;
+    pool->queue = task;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void avl_pool_join(avl_pool *pool, avl_task *task) {
+    avl_task **link, *other;
+    pthread_mutex_lock(&pool->lock);
+    if (task->state == AVL_TASK_QUEUED) {
+        // nobody took it: pull it back out and run it here
+        for (link = &pool->queue; *link != task; link = &(*link)->next)
+            ;
+        *link = task->next;
+        avl_pool_run(pool, task);
+    }
+    while (task->state != AVL_TASK_DONE) {
+        if ((other = pool->queue) != NULL) {
+            pool->queue = other->next;
+            avl_pool_run(pool, other);
+        }
+        else {
+            pthread_cond_wait(&task->done, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    pthread_cond_destroy(&task->done);
+}
+
+static avl_node_t avl_set_apply(avl_pool *pool, cmp_func compare, int op, avl_node_t a, avl_node_t b);
+
+static void avl_set_task(void *arg) {
+    avl_setop *s = (avl_setop *)arg;
+    s->result = avl_set_apply(s->pool, s->compare, s->op, s->a, s->b);
+}
+
+/* Splits a by b's root k and combines the halves of both around it. */
+static avl_node_t avl_set_apply(avl_pool *pool, cmp_func compare, int op, avl_node_t a, avl_node_t b) {
+    avl_node_t k = b, bl, br, al, ar, found, right;
+    avl_setop left;
+    avl_task task;
+    int forked;
+    if (a == NULL || b == NULL) {
+        if (op == AVL_UNION) {
+            return a != NULL ? a : b;
+        }
+        avl_tree_free_nodes(b);
+        if (op == AVL_INTERSECTION) {
+            avl_tree_free_nodes(a);
+            return NULL;
+        }
+        return a;
+    }
+    bl = k->left;
+    br = k->right;
+    if (bl) bl->parent = NULL;
+    if (br) br->parent = NULL;
+    found = avl_tree_split_nodes(a, k->data, compare, &al, &ar);
+
+    left.pool = pool;
+    left.compare = compare;
+    left.op = op;
+    left.a = al;
+    left.b = bl;
+    forked = pool != NULL && pool->nthreads > 0 &&
+             avl_tree_height(al) > AVL_SET_GRAIN_HEIGHT && avl_tree_height(bl) > AVL_SET_GRAIN_HEIGHT;
+    if (forked) {
+        task.fn = avl_set_task;
+        task.arg = &left;
+        avl_pool_fork(pool, &task);
+    }
+    else {
+        avl_set_task(&left);
+    }
+    right = avl_set_apply(pool, compare, op, ar, br);
+    if (forked) {
+        avl_pool_join(pool, &task);
+    }
+
+    if (found != NULL) {
+        free(k);
+        k = found;      // ties keep the node, and value, from a
+    }
+    if (op == AVL_UNION || (op == AVL_INTERSECTION && found != NULL)) {
+        return avl_tree_join_nodes(left.result, k, right);
+    }
+    free(k);            // a miss in an intersection, or anything in a difference
+    return avl_tree_join2_nodes(left.result, right);
+}
+
+void avl_tree_union(avl_tree_t t, avl_tree_t other, cmp_func compare, avl_pool *pool) {
+    t->root = avl_set_apply(pool, compare, AVL_UNION, t->root, other->root);
+    other->root = NULL;
+}
+
+void avl_tree_intersection(avl_tree_t t, avl_tree_t other, cmp_func compare, avl_pool *pool) {
+    t->root = avl_set_apply(pool, compare, AVL_INTERSECTION, t->root, other->root);
+    other->root = NULL;
+}
+
+void avl_tree_difference(avl_tree_t t, avl_tree_t other, cmp_func compare, avl_pool *pool) {
+    t->root = avl_set_apply(pool, compare, AVL_DIFFERENCE, t->root, other->root);
+    other->root = NULL;
+}
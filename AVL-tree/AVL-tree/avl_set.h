@@ -0,0 +1,57 @@
+//
+//  avl_set.h
+//  AVL-tree
+//
+//  Union, intersection and difference of AVL trees built on split and
+//  join. Each operation splits one tree by the other's root and recurses
+//  on the two halves, so it costs O(m log(n/m + 1)) for trees of m <= n
+//  nodes instead of m inserts or deletes. The two halves are independent;
+//  with a pool, large ones run on different threads.
+//
+
+#ifndef AVL_tree_avl_set_h
+#define AVL_tree_avl_set_h
+
+#include <pthread.h>
+#include "avl_tree.h"
+
+#define AVL_SET_MAX_THREADS     64
+
+typedef struct avl_task {
+    void (*fn)(void *arg);
+    void *arg;
+    int state;                  /* queued, running or done */
+    pthread_cond_t done;        /* signalled to the forking thread when done */
+    struct avl_task *next;
+} avl_task;
+
+/* Fork-join pool. Forked tasks go on one LIFO queue. A thread waiting for
+ * a task runs it itself if nobody has started it yet, and otherwise runs
+ * other queued tasks meanwhile, so nested forks cannot deadlock.
+ *
+ * Every fork and join goes through the one lock and queue, so the pool is
+ * meant for a handful of threads on large trees; scaling past that has not
+ * been measured, and there is no per-thread deque or work stealing yet. */
+typedef struct {
+    pthread_t threads[AVL_SET_MAX_THREADS];
+    unsigned int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* a task was queued, or stop */
+    avl_task *queue;
+    int stop;
+} avl_pool;
+
+/* 'threads' workers besides the callers; NULL if none could be started */
+avl_pool *avl_pool_create(unsigned int threads);
+void avl_pool_destroy(avl_pool *pool);
+
+/* Each of these leaves the result in 't' and empties 'other'. Nodes of
+ * 'other' either move into 't' or are freed; nodes of 't' that drop out are
+ * freed. Values are never freed, and on a tie the value in 't' is kept.
+ * 'pool' may be NULL to run everything on the calling thread. */
+void avl_tree_union(avl_tree_t t, avl_tree_t other, cmp_func compare, avl_pool *pool);
+void avl_tree_intersection(avl_tree_t t, avl_tree_t other, cmp_func compare, avl_pool *pool);
+/* removes from 't' everything that is in 'other' */
+void avl_tree_difference(avl_tree_t t, avl_tree_t other, cmp_func compare, avl_pool *pool);
+
+#endif
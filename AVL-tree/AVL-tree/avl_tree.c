@@ -0,0 +1,416 @@
+//
+//  avl_tree.c
+//  AVL-tree
+//
+//  Created by Guanshan Liu on 02/08/2011.
+//  Copyright 2011 Guanshan Liu. All rights reserved.
+//
+
+#include<stdlib.h>
+#include "avl_tree.h"
+
+avl_tree_t avl_tree_create(void) {
+    avl_tree_t t = (avl_tree_t)malloc(sizeof(avl_tree));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->root = NULL;
+    return t;
+}
+
+avl_node_t avl_tree_node_create(void *value) {
+    avl_node_t n = (avl_node_t)malloc(sizeof(avl_node));
+    if (n == NULL) {
+        return NULL;
+    }
+    n->data = value;
+    n->left = NULL;
+    n->right = NULL;
+    n->parent = NULL; // not associated with parent here
+    n->height = 1;
+    return n;
+}
+
+avl_node_t avl_tree_lookup(avl_tree_t t, void *value, cmp_func compare) {
+    if (t == NULL || t->root == NULL) {
+        return NULL;
+    }
+    avl_node_t n = t->root;
+    while (n != NULL) {
+        int result = compare(value, n->data);
+        if (result == 0) {
+            return n;
+        }
+        else if (result > 0) {
+            n = n->right;
+        }
+        else {
+            n = n->left;
+        }
+    }
+    return NULL;
+}
+
+int avl_tree_height(avl_node_t cur) {
+    return cur == NULL ? 0 : cur->height;
+}
+
+/* recomputes the cached height from the children's */
+void avl_tree_update_height(avl_node_t n) {
+    int l = avl_tree_height(n->left);
+    int r = avl_tree_height(n->right);
+    n->height = 1 + (l >= r ? l : r);
+}
+
+int avl_tree_balance_factor(avl_node_t root) {
+    if (root == NULL) {
+        return 0;
+    }
+    return avl_tree_height(root->left) - avl_tree_height(root->right);
+}
+
+void avl_tree_rotate_right(avl_tree_t t, avl_node_t main, avl_node_t pivot) {
+    avl_node_t hold = NULL;
+    pivot->parent = main->parent;
+    if (main->parent != NULL && main == main->parent->left) {
+        main->parent->left = pivot;
+    }
+    else if (main->parent != NULL && main == main->parent->right) {
+        main->parent->right = pivot;
+    }
+    else {
+        pivot->parent = NULL;
+        t->root = pivot;
+    }
+    if (pivot->right != NULL) {
+        hold = pivot->right;
+    }
+    pivot->right = main;
+    pivot->right->left = hold;
+    if (hold) {
+		hold->parent = pivot->right;
+    }
+    main->parent = pivot;
+    avl_tree_update_height(main);
+    avl_tree_update_height(pivot);
+}
+
+void avl_tree_rotate_left(avl_tree_t t, avl_node_t main, avl_node_t pivot) {
+    avl_node_t hold = NULL;
+    pivot->parent = main->parent;
+    if (main->parent != NULL && main == main->parent->right) {
+        main->parent->right = pivot;
+    }
+    else if (main->parent != NULL && main == main->parent->left) {
+        main->parent->left = pivot;
+    }
+    else {
+        pivot->parent = NULL;
+        t->root = pivot;
+    }
+    if (pivot->left != NULL) {
+        hold = pivot->left;
+    }
+    pivot->left = main;
+    pivot->left->right = hold;
+    if (hold) {
+		hold->parent = pivot->left;
+    }
+    main->parent = pivot;
+    avl_tree_update_height(main);
+    avl_tree_update_height(pivot);
+}
+
+/* Refreshes n's height, then rotates if its children differ by two. The
+ * children's heights must already be current. Returns the node now at n's
+ * place. */
+avl_node_t avl_tree_balance(avl_tree_t t, avl_node_t n) {
+    int factor;
+    avl_tree_update_height(n);
+    factor = avl_tree_balance_factor(n);
+    if (factor == 2 && avl_tree_balance_factor(n->left) >= 0) {
+        avl_tree_rotate_right(t, n, n->left);
+    }
+    else if (factor == -2 && avl_tree_balance_factor(n->right) <= 0) {
+        avl_tree_rotate_left(t, n, n->right);
+    }
+    else if (factor == -2) {
+        avl_tree_rotate_right(t, n->right, n->right->left);
+        avl_tree_rotate_left(t, n, n->right);
+    }
+    else if (factor == 2) {
+        avl_tree_rotate_left(t, n->left, n->left->right);
+        avl_tree_rotate_right(t, n, n->left);
+    }
+    else {
+        return n;
+    }
+    return n->parent;           // every rotation leaves n right below its replacement
+}
+
+/* Rebalances from n towards the root. Stops at the first subtree whose
+ * height came out the same as before, as nothing above it changed. */
+static void avl_balance(avl_tree_t t, avl_node_t n) {
+    avl_node_t parent;
+    int height;
+    while (n != NULL) {
+        parent = n->parent;     // a rotation moves n below its replacement
+        height = n->height;
+        if (avl_tree_balance(t, n)->height == height) {
+            break;
+        }
+        n = parent;
+    }
+}
+
+/* One descent: links the new leaf under the last node compared, then
+ * walks back up through the parent links. */
+int avl_tree_insert(avl_tree_t t, void *value, cmp_func compare) {
+    avl_node_t n = t->root, parent = NULL, leaf;
+    int result = 0;
+    while (n != NULL) {
+        result = compare(value, n->data);
+        if (result == 0) {
+            return -1;
+        }
+        parent = n;
+        n = result > 0 ? n->right : n->left;
+    }
+    leaf = avl_tree_node_create(value);
+    if (leaf == NULL) {
+        return 0;
+    }
+    leaf->parent = parent;
+    if (parent == NULL) {
+        t->root = leaf;
+    }
+    else if (result > 0) {
+        parent->right = leaf;
+    }
+    else {
+        parent->left = leaf;
+    }
+    avl_balance(t, parent);
+    return -1;
+}
+
+static void avl_tree_parent_change(avl_tree_t t, avl_node_t min, avl_node_t p) {
+    if (min != NULL) min->parent = p->parent;
+    if(p->parent != NULL && p == p->parent->right) p->parent->right = min;
+    else if(p->parent != NULL && p == p->parent->left) p->parent->left=min;
+    else t->root = min;
+}
+
+static avl_node_t avl_tree_delete_replace(avl_node_t victim) {
+    avl_node_t t;
+    if((!victim->right) && (!victim->left)) return victim;
+    else if(victim->right)
+    {
+        if(!victim->right->left) return victim->right;
+        else{
+            for(t=victim->right;t->left!=0;t=t->left);
+            return t;
+        }
+    }
+    else if(victim->left)
+    {
+        if(!victim->left->right) return victim->left;
+        else{
+            for(t=victim->left;t->right!=0;t=t->right);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/* Unlinks and frees the node holding value. Returns the lowest node whose
+ * subtree lost height, where rebalancing starts, or NULL. */
+static avl_node_t avl_delete(avl_tree_t t, void *value, cmp_func compare) {
+    avl_node_t p = avl_tree_lookup(t, value, compare);
+    avl_node_t min, start;
+    if (p == NULL) {
+        return NULL;
+    }
+    min = avl_tree_delete_replace(p);
+    if (min == p) {
+        start = p->parent;
+        avl_tree_parent_change(t, NULL, p);
+    }
+    else if (p->right != NULL) {
+        // min is the leftmost node of the right subtree
+        if (min != p->right) {
+            start = min->parent;
+            min->parent->left = min->right;
+            if (min->right) min->right->parent = min->parent;
+            min->right = p->right;
+            min->right->parent = min;
+        }
+        else {
+            start = min;
+        }
+        min->left = p->left;
+        if (min->left) min->left->parent = min;
+        avl_tree_parent_change(t, min, p);
+    }
+    else {
+        // no right subtree: min is the rightmost node of the left one
+        if (min != p->left) {
+            start = min->parent;
+            min->parent->right = min->left;
+            if (min->left) min->left->parent = min->parent;
+            min->left = p->left;
+            min->left->parent = min;
+        }
+        else {
+            start = min;
+        }
+        min->right = NULL;
+        avl_tree_parent_change(t, min, p);
+    }
+    if (min != p) {
+        min->height = p->height;    // what the ancestors were balanced against
+    }
+    free(p);
+    return start;
+}
+
+void avl_tree_delete(avl_tree_t t, void *value, cmp_func compare) {
+    avl_balance(t, avl_delete(t, value, compare));
+}
+
+/* n as a root of its own, or NULL */
+static avl_node_t avl_tree_detach(avl_node_t n) {
+    if (n != NULL) {
+        n->parent = NULL;
+    }
+    return n;
+}
+
+avl_node_t avl_tree_join_nodes(avl_node_t left, avl_node_t middle, avl_node_t right) {
+    avl_tree tmp;
+    avl_node_t c, p = NULL;
+    int hl = avl_tree_height(left), hr = avl_tree_height(right);
+    if (hl > hr + 1) {
+        // hang middle and right off left's right spine where they fit
+        tmp.root = left;
+        for (c = left; avl_tree_height(c) > hr + 1; c = c->right) {
+            p = c;
+        }
+        middle->left = c;
+        middle->right = right;
+        p->right = middle;
+    }
+    else if (hr > hl + 1) {
+        tmp.root = right;
+        for (c = right; avl_tree_height(c) > hl + 1; c = c->left) {
+            p = c;
+        }
+        middle->left = left;
+        middle->right = c;
+        p->left = middle;
+    }
+    else {
+        tmp.root = middle;
+        middle->left = left;
+        middle->right = right;
+    }
+    middle->parent = p;
+    if (middle->left) middle->left->parent = middle;
+    if (middle->right) middle->right->parent = middle;
+    avl_tree_update_height(middle);
+    avl_balance(&tmp, p);
+    return tmp.root;
+}
+
+/* n's subtree without its maximum, which ends up detached in *last */
+static avl_node_t avl_tree_split_last(avl_node_t n, avl_node_t *last) {
+    avl_node_t l = avl_tree_detach(n->left), r = avl_tree_detach(n->right);
+    if (r == NULL) {
+        *last = n;
+        return l;
+    }
+    return avl_tree_join_nodes(l, n, avl_tree_split_last(r, last));
+}
+
+avl_node_t avl_tree_join2_nodes(avl_node_t left, avl_node_t right) {
+    avl_node_t last;
+    if (left == NULL) {
+        return right;
+    }
+    left = avl_tree_split_last(left, &last);
+    return avl_tree_join_nodes(left, last, right);
+}
+
+avl_node_t avl_tree_split_nodes(avl_node_t n, void *value, cmp_func compare, avl_node_t *left, avl_node_t *right) {
+    avl_node_t l, r, found;
+    int result;
+    if (n == NULL) {
+        *left = *right = NULL;
+        return NULL;
+    }
+    l = avl_tree_detach(n->left);
+    r = avl_tree_detach(n->right);
+    result = compare(value, n->data);
+    if (result == 0) {
+        *left = l;
+        *right = r;
+        n->left = n->right = NULL;
+        n->height = 1;
+        return n;
+    }
+    if (result < 0) {
+        found = avl_tree_split_nodes(l, value, compare, left, &l);
+        *right = avl_tree_join_nodes(l, n, r);
+    }
+    else {
+        found = avl_tree_split_nodes(r, value, compare, &r, right);
+        *left = avl_tree_join_nodes(l, n, r);
+    }
+    return found;
+}
+
+avl_node_t avl_tree_split(avl_tree_t t, void *value, cmp_func compare, avl_tree_t right) {
+    avl_node_t l, r, found = avl_tree_split_nodes(t->root, value, compare, &l, &r);
+    t->root = l;
+    right->root = r;
+    return found;
+}
+
+void avl_tree_join(avl_tree_t t, avl_tree_t right) {
+    t->root = avl_tree_join2_nodes(t->root, right->root);
+    right->root = NULL;
+}
+
+/* height of n's subtree, or -1 if a cached height, a balance factor or a
+ * parent link is wrong anywhere below */
+static int avl_tree_check(avl_node_t n, avl_node_t parent) {
+    int l, r;
+    if (n == NULL) {
+        return 0;
+    }
+    l = avl_tree_check(n->left, n);
+    r = avl_tree_check(n->right, n);
+    if (l < 0 || r < 0 || n->parent != parent || l - r > 1 || r - l > 1 ||
+        n->height != 1 + (l >= r ? l : r)) {
+        return -1;
+    }
+    return n->height;
+}
+
+int avl_tree_verify(avl_tree_t t) {
+    return avl_tree_check(t->root, NULL) >= 0 ? -1 : 0;
+}
+
+void avl_tree_free_nodes(avl_node_t n) {
+    if (n == NULL) {
+        return;
+    }
+    avl_tree_free_nodes(n->left);
+    avl_tree_free_nodes(n->right);
+    free(n);
+}
+
+void avl_tree_destroy(avl_tree_t t) {
+    avl_tree_free_nodes(t->root);
+    free(t);
+}
@@ -0,0 +1,72 @@
+//
+//  avl_tree.h
+//  AVL-tree
+//
+//  Created by Guanshan Liu on 02/08/2011.
+//  Copyright 2011 Guanshan Liu. All rights reserved.
+//
+//  Every node caches the height of its subtree, so balancing is O(1) per
+//  node and insert, delete and lookup are O(log n).
+//
+
+#ifndef AVL_tree_avl_tree_h
+#define AVL_tree_avl_tree_h
+
+typedef struct avl_node {
+    void *data;
+    struct avl_node *parent;
+    struct avl_node *left;
+    struct avl_node *right;
+    int height;                 /* of the subtree, 1 for a leaf */
+} avl_node;
+
+typedef avl_node *avl_node_t;
+
+typedef struct {
+    avl_node_t root;
+} avl_tree;
+
+typedef avl_tree *avl_tree_t;
+
+#ifndef TREE_CMP_FUNC
+#define TREE_CMP_FUNC
+typedef int (*cmp_func)(void *left, void *right);
+#endif
+
+avl_tree_t avl_tree_create(void);
+avl_node_t avl_tree_node_create(void *value);
+/* the node holding a value equal to 'value', or NULL */
+avl_node_t avl_tree_lookup(avl_tree_t t, void *value, cmp_func compare);
+/* -1 when inserted or already present, 0 when out of memory */
+int avl_tree_insert(avl_tree_t t, void *value, cmp_func compare);
+void avl_tree_delete(avl_tree_t t, void *value, cmp_func compare);
+/* -1 if heights, balance and parent links are all consistent, 0 if not; O(n) */
+int avl_tree_verify(avl_tree_t t);
+/* frees the tree and its nodes, not the values */
+void avl_tree_destroy(avl_tree_t t);
+
+/* Moves the nodes above 'value' into 'right', which must be empty, and
+ * leaves those below it in 't'. The node equal to 'value' is unlinked
+ * from both and returned, or NULL. O(log n). */
+avl_node_t avl_tree_split(avl_tree_t t, void *value, cmp_func compare, avl_tree_t right);
+/* Appends every node of 'right' to 't' and empties 'right'. Everything in
+ * 't' must be below everything in 'right'. O(log n). */
+void avl_tree_join(avl_tree_t t, avl_tree_t right);
+
+/* The same on bare subtrees. Roots go in and come out with a NULL parent.
+ * join_nodes links a detached node between two subtrees, in
+ * O(|height(left) - height(right)|). */
+avl_node_t avl_tree_join_nodes(avl_node_t left, avl_node_t middle, avl_node_t right);
+avl_node_t avl_tree_join2_nodes(avl_node_t left, avl_node_t right);
+avl_node_t avl_tree_split_nodes(avl_node_t n, void *value, cmp_func compare, avl_node_t *left, avl_node_t *right);
+void avl_tree_free_nodes(avl_node_t n);
+
+/* helpers */
+int avl_tree_height(avl_node_t cur);
+void avl_tree_update_height(avl_node_t n);
+int avl_tree_balance_factor(avl_node_t root);
+void avl_tree_rotate_right(avl_tree_t t, avl_node_t main, avl_node_t pivot);
+void avl_tree_rotate_left(avl_tree_t t, avl_node_t main, avl_node_t pivot);
+avl_node_t avl_tree_balance(avl_tree_t t, avl_node_t n);
+
+#endif
@@ -8,297 +8,310 @@
 
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<pthread.h>
+#include "avl_tree.h"
+#include "avl_set.h"
+#include "avl_persistent.h"
+#include "../../common/bench.h"
 
-typedef struct avl_node {
-    void *data;
-    struct avl_node *parent;
-    struct avl_node *left;
-    struct avl_node *right;
-} avl_node;
-
-typedef avl_node *avl_node_t;
+#define DEFAULT_KEY_COUNT   1000000
+#define READER_THREADS      3
+#define READER_BATCH        64      /* lookups per lock or snapshot */
+#define WRITER_OPS          200000
 
 typedef struct {
-    avl_node_t root;
-} avl_tree;
-
-typedef avl_tree *avl_tree_t;
-
-typedef int (*cmp_func)(void *left, void *right);
+    avl_tree_t t;                   /* behind 'lock', or */
+    pthread_mutex_t *lock;
+    avl_ptree *p;                   /* snapshots, no lock for readers */
+    int *keys;
+    unsigned int count;
+    int stop;
+    unsigned long lookups;
+    unsigned int seed;
+} readerargs;
 
-avl_tree_t avl_tree_create();
-avl_node_t avl_tree_node_create(void *value);
-avl_node_t avl_tree_lookup(avl_tree_t t, void *value, cmp_func compare);
-int avl_tree_height(avl_node_t cur);
-int avl_tree_balance_factor(avl_node_t root);
-void avl_tree_rotate_right(avl_tree_t t, avl_node_t main, avl_node_t pivot);
-void avl_tree_rotate_left(avl_tree_t t, avl_node_t main, avl_node_t pivot);
-void avl_tree_balance(avl_tree_t t, avl_node_t n);
+void *scaling_create(void);
+void scaling_insert(void *t, void *key);
+void scaling_lookup(void *t, void *key);
+void scaling_delete(void *t, void *key);
+int scaling_verify(void *t);
+void scaling_destroy(void *t);
+unsigned int collect(avl_node_t n, void **out, unsigned int i);
+void build_operands(int *keys, unsigned int count, avl_tree_t a, avl_tree_t b);
+void bench_setops(unsigned int count);
+void *reader_worker(void *args);
+double churn(avl_tree_t t, pthread_mutex_t *lock, avl_ptree *p, int *keys, unsigned int count);
+void bench_persistent(unsigned int count);
 
-avl_tree_t avl_tree_create() {
-    avl_tree_t t = (avl_tree_t)malloc(sizeof(avl_tree));
-    if (t == NULL) {
-        return NULL;
-    }
-    t->root = NULL;
-    return t;
+void *scaling_create(void) {
+    return avl_tree_create();
 }
 
-avl_node_t avl_tree_node_create(void *value) {
-    avl_node_t n = (avl_node_t)malloc(sizeof(avl_node));
-    if (n == NULL) {
-        return NULL;
-    }
-    n->data = value;
-    n->left = NULL;
-    n->right = NULL;
-    n->parent = NULL; // not associated with parent here
-    return n;
+void scaling_insert(void *t, void *key) {
+    avl_tree_insert((avl_tree_t)t, key, bench_int_cmp);
 }
 
-avl_node_t avl_tree_lookup(avl_tree_t t, void *value, cmp_func compare) {
-    if (t == NULL || t->root == NULL) {
-        return NULL;
-    }
-    avl_node_t n = t->root;
-    while (n != NULL) {
-        int result = compare(n->data, value);
-        if (result == 0) {
-            return n;
-        }
-        else if (result > 0) {
-            n = n->right;
-        }
-        else {
-            n = n->left;
-        }
-    }
-    return NULL;
+void scaling_lookup(void *t, void *key) {
+    avl_tree_lookup((avl_tree_t)t, key, bench_int_cmp);
 }
 
-int avl_tree_height(avl_node_t cur) {
-    if (cur == NULL) {
-        return 0;
-    }
-    
-    int l = 1 + avl_tree_height(cur->left);
-    int r = 1 + avl_tree_height(cur->right);
-    return l >= r ? l : r;
+void scaling_delete(void *t, void *key) {
+    avl_tree_delete((avl_tree_t)t, key, bench_int_cmp);
 }
 
-int avl_tree_balance_factor(avl_node_t root) {
-    if (root == NULL) {
-        return 0;
-    }
-    return avl_tree_height(root->left) - avl_tree_height(root->right);
+int scaling_verify(void *t) {
+    return avl_tree_verify((avl_tree_t)t);
 }
 
-void avl_tree_rotate_right(avl_tree_t t, avl_node_t main, avl_node_t pivot) {
-    avl_node_t hold = NULL;
-    pivot->parent = main->parent;
-    if (main->parent != NULL && main == main->parent->left) {
-        main->parent->left = pivot;
-    }
-    else if (main->parent != NULL && main == main->parent->right) {
-        main->parent->right = pivot;
-    }
-    else {
-        pivot->parent = NULL;
-        t->root = pivot;
-    }
-    if (pivot->right != NULL) {
-        hold = pivot->right;
-    }
-    pivot->right = main;
-    pivot->right->left = hold;
-    if (hold) {
-		hold->parent = pivot->right;
-    }
-    main->parent = pivot;
+void scaling_destroy(void *t) {
+    avl_tree_destroy((avl_tree_t)t);
 }
 
-void avl_tree_rotate_left(avl_tree_t t, avl_node_t main, avl_node_t pivot) {
-    avl_node_t hold = NULL;
-    pivot->parent = main->parent;
-    if (main->parent != NULL && main == main->parent->right) {
-        main->parent->right = pivot;
-    }
-    else if (main->parent != NULL && main == main->parent->left) {
-        main->parent->left = pivot;
-    }
-    else {
-        pivot->parent = NULL;
-        t->root = pivot;
-    }
-    if (pivot->left != NULL) {
-        hold = pivot->left;
-    }
-    pivot->left = main;
-    pivot->left->right = hold;
-    if (hold) {
-		hold->parent = pivot->left;
+/* heights are cached in the nodes, so every operation is O(log n) */
+const bench_scaling_ops scaling_ops = {
+    "lookup", "delete",
+    scaling_create, scaling_insert, scaling_lookup, scaling_delete, scaling_verify, scaling_destroy
+};
+
+/* stores n's values in order at out[i..], returns the index past them */
+unsigned int collect(avl_node_t n, void **out, unsigned int i) {
+    for (; n != NULL; n = n->right) {
+        i = collect(n->left, out, i);
+        out[i++] = n->data;
     }
-    main->parent = pivot;
+    return i;
 }
 
-void avl_tree_balance(avl_tree_t t, avl_node_t n) {
-    if (avl_tree_balance_factor(n) == 2 && avl_tree_balance_factor(n->left) >= 0) {
-        avl_tree_rotate_right(t, n, n->left);
-    }
-    else if (avl_tree_balance_factor(n) == -2 && avl_tree_balance_factor(n->right) <= 0) {
-        avl_tree_rotate_left(t, n, n->right);
-    }
-    else if (avl_tree_balance_factor(n) == -2 && avl_tree_balance_factor(n->right) >= 0) {
-        avl_tree_rotate_right(t, n->right, n->right->left);
-        avl_tree_rotate_left(t, n, n->right);
-    }
-    else if (avl_tree_balance_factor(n) == 2 && avl_tree_balance_factor(n->right) <= 0) {
-        avl_tree_rotate_left(t, n->left, n->left->right);
-        avl_tree_rotate_right(t, n, n->left);
+/* a holds 0 .. count-1, b the even keys below 2 * count: they share half of a */
+void build_operands(int *keys, unsigned int count, avl_tree_t a, avl_tree_t b) {
+    unsigned int i;
+    for (i = 0; i < 2 * count; i++) {
+        if ((unsigned int)keys[i] < count) {
+            avl_tree_insert(a, &keys[i], bench_int_cmp);
+        }
+        if (keys[i] % 2 == 0) {
+            avl_tree_insert(b, &keys[i], bench_int_cmp);
+        }
     }
 }
 
-void avl_tree_insert(avl_tree_t t, void *value, cmp_func compare);
-void avl_insert(avl_tree_t t, avl_node_t n, void *value, cmp_func compare);
-void avl_balance(avl_tree_t t, avl_node_t n);
+/* Each set operation on two trees of 'count' keys, element by element
+ * through insert/lookup/delete, then split/join based on the calling
+ * thread only and on a pool with one worker per online CPU. */
+void bench_setops(unsigned int count) {
+    const char *names[] = { "union", "intersection", "difference" };
+    int *keys = bench_keys(2 * count, BENCH_KEY_SEED);
+    void **values = (void **)malloc(sizeof(void *) * 2 * count);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    avl_pool *pool = avl_pool_create(cpus > 1 ? (unsigned int)cpus : 1);
+    avl_tree_t a, b, r;
+    unsigned int op, mode, i, n, size;
+    double start, ns[3];
+    int valid;
 
-void avl_insert(avl_tree_t t, avl_node_t n, void *value, cmp_func compare) {
-    if (n == NULL && n == t->root) {
-        t->root = avl_tree_node_create(value);
+    if (keys == NULL || values == NULL || pool == NULL) {
+        free(keys);
+        free(values);
+        if (pool != NULL) avl_pool_destroy(pool);
+        return;
     }
-    else {
-        int result = compare(value, n->data);
-        if (result == 0) {
-            return;
-        }
-        else if (result > 0) {
-            if (n->right != NULL) {
-                return avl_insert(t, n->right, value, compare);
+    for (op = 0; op < 3; op++) {
+        valid = 1;
+        size = 0;
+        for (mode = 0; mode < 3; mode++) {
+            a = avl_tree_create();
+            b = avl_tree_create();
+            build_operands(keys, count, a, b);
+            start = bench_now_ns();
+            if (mode == 0) {
+                if (op == 0) {
+                    n = collect(b->root, values, 0);
+                    for (i = 0; i < n; i++) {
+                        avl_tree_insert(a, values[i], bench_int_cmp);
+                    }
+                }
+                else if (op == 1) {
+                    r = avl_tree_create();
+                    n = collect(a->root, values, 0);
+                    for (i = 0; i < n; i++) {
+                        if (avl_tree_lookup(b, values[i], bench_int_cmp) != NULL) {
+                            avl_tree_insert(r, values[i], bench_int_cmp);
+                        }
+                    }
+                    avl_tree_destroy(a);
+                    a = r;
+                }
+                else {
+                    n = collect(b->root, values, 0);
+                    for (i = 0; i < n; i++) {
+                        avl_tree_delete(a, values[i], bench_int_cmp);
+                    }
+                }
             }
-            else {
-                n->right = avl_tree_node_create(value);
-                n->right->parent = n;
+            else if (op == 0) {
+                avl_tree_union(a, b, bench_int_cmp, mode == 2 ? pool : NULL);
             }
-        }
-        else {
-            if (n->left != NULL) {
-                return avl_insert(t, n->left, value, compare);
+            else if (op == 1) {
+                avl_tree_intersection(a, b, bench_int_cmp, mode == 2 ? pool : NULL);
             }
             else {
-                n->left = avl_tree_node_create(value);
-                n->left->parent = n;
+                avl_tree_difference(a, b, bench_int_cmp, mode == 2 ? pool : NULL);
             }
+            ns[mode] = bench_now_ns() - start;
+            n = collect(a->root, values, 0);
+            valid = valid && avl_tree_verify(a) && (mode == 0 || n == size);
+            size = n;
+            avl_tree_destroy(a);
+            avl_tree_destroy(b);
         }
+        printf("%-12s %8u+%-8u keys  element-wise %8.1f  join %8.1f  join on %u threads %8.1f ms  -> %u keys%s\n",
+               names[op], count, count, ns[0] / 1e6, ns[1] / 1e6, pool->nthreads, ns[2] / 1e6,
+               size, valid ? "" : "  INVALID");
     }
+    avl_pool_destroy(pool);
+    free(keys);
+    free(values);
 }
 
-void avl_balance(avl_tree_t t, avl_node_t n) {
-    if (n == NULL) {
-        return;
-    }
-    while(n->parent != NULL) {
-        avl_tree_balance(t, n->parent);
-        if (n->parent) {
-            n = n->parent;
+void *reader_worker(void *args) {
+    readerargs *a = (readerargs *)args;
+    const avl_pnode *root = NULL;
+    unsigned int i, x = a->seed;
+    unsigned long lookups = 0;
+    while (!__atomic_load_n(&a->stop, __ATOMIC_RELAXED)) {
+        if (a->p != NULL) {
+            root = avl_ptree_snapshot(a->p);
         }
-    }
-}
-
-void avl_tree_insert(avl_tree_t t, void *value, cmp_func compare) {
-    if (t == NULL) {
-        t = avl_tree_create();
-        if (t == NULL) {
-            return;
+        else {
+            pthread_mutex_lock(a->lock);
         }
-    }
-    avl_insert(t, t->root, value, compare);
-    if(t->root != NULL) {
-        avl_balance(t, avl_tree_lookup(t, value, compare));
-    }
-}
-
-void avl_tree_parent_change(avl_tree_t t, avl_node_t min, avl_node_t p);
-avl_node_t avl_tree_delete_replace(avl_node_t victim);
-void avl_tree_delete(avl_tree_t t, void *value, cmp_func compare);
-avl_node_t avl_delete(avl_tree_t t, void *value, cmp_func compare);
-
-void avl_tree_parent_change(avl_tree_t t, avl_node_t min, avl_node_t p) {
-    min->parent = p->parent;
-    if(p->parent != NULL && p == p->parent->right) p->parent->right = min;
-    else if(p->parent != NULL && p == p->parent->left) p->parent->left=min;
-    else t->root = min;
-}
-
-avl_node_t avl_tree_delete_replace(avl_node_t victim) {
-    avl_node_t t;
-    if((!victim->right) && (!victim->left)) return victim;
-    else if(victim->right)
-    {
-        if(!victim->right->left) return victim->right;
-        else{
-            for(t=victim->right;t->left!=0;t=t->left);
-            return t;
+        for (i = 0; i < READER_BATCH; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            if (a->p != NULL) {
+                avl_ptree_lookup(root, &a->keys[x % a->count], bench_int_cmp);
+            }
+            else {
+                avl_tree_lookup(a->t, &a->keys[x % a->count], bench_int_cmp);
+            }
         }
-    }
-    else if(victim->left)
-    {
-        if(!victim->left->right) return victim->left;
-        else{
-            for(t=victim->left;t->right!=0;t=t->right);
-            return t;
+        if (a->p != NULL) {
+            avl_ptree_release(a->p);
+        }
+        else {
+            pthread_mutex_unlock(a->lock);
         }
+        lookups += READER_BATCH;
     }
+    a->lookups = lookups;
     return NULL;
 }
 
-avl_node_t avl_delete(avl_tree_t t, void *value, cmp_func compare) {
-    avl_node_t p = avl_tree_lookup(t, value, compare);
-    if (p == NULL) {
-        return NULL;
-    }
-    avl_node_t min = avl_tree_delete_replace(p);
-    if(p->right != NULL){
-        if(min!=p->right){
-            min->parent->left = NULL;
-            min->right = p->right;
-            min->right->parent = min;
-        }
-        if(p->left != NULL){
-            min->left = p->left;
-            min->left->parent = min;
-            avl_tree_parent_change(t, min, p);
+/* WRITER_OPS random deletes and reinserts, returns ns per pair */
+double churn(avl_tree_t t, pthread_mutex_t *lock, avl_ptree *p, int *keys, unsigned int count) {
+    unsigned int i, x = 2463534242u;
+    int *key;
+    double start = bench_now_ns();
+    for (i = 0; i < WRITER_OPS; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        key = &keys[x % count];
+        if (p != NULL) {
+            avl_ptree_delete(p, key);
+            avl_ptree_insert(p, key);
         }
-    }
-    else if(min == p->left){
-        min->right=0;
-        avl_tree_parent_change(t, min, p);
-    }
-    else{
-        if(p->parent){
-			if(p==p->parent->right) p->parent->right=0;
-			else p->parent->left=0;
+        else {
+            pthread_mutex_lock(lock);
+            avl_tree_delete(t, key, bench_int_cmp);
+            avl_tree_insert(t, key, bench_int_cmp);
+            pthread_mutex_unlock(lock);
         }
     }
-    free(p);
-    return min;
+    return (bench_now_ns() - start) / WRITER_OPS;
 }
 
-void avl_tree_delete(avl_tree_t t, void *value, cmp_func compare) {
-    avl_node_t par = avl_delete(t, value, compare);
-    if (par == NULL) {
+/* READER_THREADS readers doing lookups while one writer deletes and
+ * reinserts random keys, once with the plain tree behind a mutex and once
+ * with the persistent tree, where readers never wait for the writer. */
+void bench_persistent(unsigned int count) {
+    int *keys = bench_keys(count, BENCH_KEY_SEED);
+    pthread_mutex_t lock;
+    pthread_t threads[READER_THREADS];
+    readerargs args[READER_THREADS];
+    avl_tree_t t = avl_tree_create();
+    avl_ptree *p = avl_ptree_create(bench_int_cmp);
+    unsigned int round, i;
+    unsigned long lookups;
+    double alone, shared;
+
+    if (keys == NULL || t == NULL || p == NULL) {
+        free(keys);
+        if (t != NULL) avl_tree_destroy(t);
+        if (p != NULL) avl_ptree_destroy(p);
         return;
     }
-    if(par->left) avl_balance(t, par->left);
-    else if(par->right) avl_balance(t, par->right);
-    else avl_balance(t, par);
+    pthread_mutex_init(&lock, NULL);
+    for (i = 0; i < count; i++) {
+        avl_tree_insert(t, &keys[i], bench_int_cmp);
+        avl_ptree_insert(p, &keys[i]);
+    }
+    for (round = 0; round < 2; round++) {
+        alone = churn(t, &lock, round == 1 ? p : NULL, keys, count);
+        for (i = 0; i < READER_THREADS; i++) {
+            args[i].t = t;
+            args[i].lock = &lock;
+            args[i].p = round == 1 ? p : NULL;
+            args[i].keys = keys;
+            args[i].count = count;
+            args[i].stop = 0;
+            args[i].lookups = 0;
+            args[i].seed = 88172645u + i * 7919u;
+            if (pthread_create(&threads[i], NULL, reader_worker, &args[i]) != 0) {
+                args[i].stop = -1;
+            }
+        }
+        shared = churn(t, &lock, args[0].p, keys, count);
+        lookups = 0;
+        for (i = 0; i < READER_THREADS; i++) {
+            if (args[i].stop == 0) {
+                __atomic_store_n(&args[i].stop, 1, __ATOMIC_RELAXED);
+                pthread_join(threads[i], NULL);
+                lookups += args[i].lookups;
+            }
+        }
+        printf("%-10s %10u keys  writer alone %7.1f  with %u readers %8.1f ns/delete+insert  readers %6.2f Mlookups/s\n",
+               round == 1 ? "persistent" : "locked", count, alone, READER_THREADS, shared,
+               lookups / (shared * WRITER_OPS) * 1e3);
+    }
+    pthread_mutex_destroy(&lock);
+    avl_tree_destroy(t);
+    avl_ptree_destroy(p);
+    free(keys);
 }
 
-
 int main (int argc, const char * argv[])
 {
+    const char *bench = argc > 1 ? argv[1] : "all";
+    unsigned int count = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : DEFAULT_KEY_COUNT;
+    int all = strcmp(bench, "all") == 0;
+    if (count == 0) {
+        fprintf(stderr, "usage: AVL-tree [all|scaling|setops|persistent] [keys]\n");
+        return 1;
+    }
 
-    // insert test/implementation code here...
     printf("AVL tree...!\n");
+    if (all || strcmp(bench, "scaling") == 0) {
+        bench_scaling(&scaling_ops, count);
+    }
+    if (all || strcmp(bench, "setops") == 0) {
+        bench_setops(count);
+    }
+    if (all || strcmp(bench, "persistent") == 0) {
+        bench_persistent(count);
+    }
     return 0;
 }
-
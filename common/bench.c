@@ -0,0 +1,112 @@
+//
+//  bench.c
+//  common
+//
+//  Benchmark helpers, see bench.h.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include "bench.h"
+
+double bench_now_ns(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+#endif
+}
+
+unsigned long long bench_random(unsigned long long *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+int *bench_keys(unsigned int count, unsigned long long seed) {
+    int *keys = (int *)malloc(sizeof(int) * count);
+    unsigned long long x = seed;
+    unsigned int i, j;
+    int tmp;
+    if (keys == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        keys[i] = (int)i;
+    }
+    for (i = count; i > 1; i--) {
+        j = (unsigned int)(bench_random(&x) % i);
+        tmp = keys[i - 1];
+        keys[i - 1] = keys[j];
+        keys[j] = tmp;
+    }
+    return keys;
+}
+
+int bench_int_cmp(void *left, void *right) {
+    int l = *(int *)left, r = *(int *)right;
+    return l < r ? -1 : l > r;
+}
+
+/* With O(log n) operations ns/op over log2(n) stays roughly flat and
+ * creeps up only once the tree outgrows the caches. The tree is checked
+ * when full and when half emptied, outside the timed loops. */
+void bench_scaling(const bench_scaling_ops *ops, unsigned int maxcount) {
+    unsigned int count, i;
+    int *keys;
+    void *t;
+    double start, insert_ns, lookup_ns, remove_ns;
+    int valid;
+
+    for (count = BENCH_SCALING_MIN < maxcount ? BENCH_SCALING_MIN : maxcount; ; count *= BENCH_SCALING_STEP) {
+        if (count > maxcount / BENCH_SCALING_STEP && count < maxcount) {
+            count = maxcount;       /* always end on the requested size */
+        }
+        if ((keys = bench_keys(count, BENCH_KEY_SEED)) == NULL || (t = ops->create()) == NULL) {
+            free(keys);
+            return;
+        }
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            ops->insert(t, &keys[i]);
+        }
+        insert_ns = (bench_now_ns() - start) / count;
+        valid = ops->verify(t);
+
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            ops->lookup(t, &keys[(i * 7919u) % count]);
+        }
+        lookup_ns = (bench_now_ns() - start) / count;
+
+        start = bench_now_ns();
+        for (i = 0; i < count / 2; i++) {
+            ops->remove(t, &keys[i]);
+        }
+        remove_ns = bench_now_ns() - start;
+        valid = valid && ops->verify(t);
+        start = bench_now_ns();
+        for (; i < count; i++) {
+            ops->remove(t, &keys[i]);
+        }
+        remove_ns = (remove_ns + bench_now_ns() - start) / count;
+
+        printf("%10u keys  insert %7.1f  %s %7.1f  %s %7.1f ns/op  %5.2f %5.2f %5.2f ns/log2(n)%s\n",
+               count, insert_ns, ops->lookup_name, lookup_ns, ops->remove_name, remove_ns,
+               insert_ns / log2(count), lookup_ns / log2(count), remove_ns / log2(count),
+               valid ? "" : "  INVALID");
+        ops->destroy(t);
+        free(keys);
+        if (count == maxcount) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+//
+//  bench.h
+//  common
+//
+//  Pieces the benchmark drivers in the projects' main.c files share: the
+//  clock, shuffled keys, an int comparator and the sweep over growing tree
+//  sizes. A tree takes part in the sweep through a bench_scaling_ops table
+//  of small wrappers; every tree pays the same indirect call per operation,
+//  so the columns stay comparable between projects.
+//
+
+#ifndef common_bench_h
+#define common_bench_h
+
+#define BENCH_KEY_SEED      88172645463325252ull
+#define BENCH_SCALING_MIN   1000
+#define BENCH_SCALING_STEP  4
+
+typedef struct {
+    const char *lookup_name;        /* column labels */
+    const char *remove_name;
+    void *(*create)(void);
+    void (*insert)(void *tree, void *key);
+    void (*lookup)(void *tree, void *key);
+    void (*remove)(void *tree, void *key);
+    int (*verify)(void *tree);      /* non-zero when the tree is well formed */
+    void (*destroy)(void *tree);
+} bench_scaling_ops;
+
+/* nanoseconds from an arbitrary start, monotonic where the system has it */
+double bench_now_ns(void);
+
+/* xorshift64, '*x' must not be 0 */
+unsigned long long bench_random(unsigned long long *x);
+
+/* 0 .. count-1 in a random order fixed by 'seed', malloc'd; NULL when out of memory */
+int *bench_keys(unsigned int count, unsigned long long seed);
+
+int bench_int_cmp(void *left, void *right);
+
+/* insert, lookup and remove cost per op and per log2(n), for sizes from
+ * BENCH_SCALING_MIN up to 'maxcount' */
+void bench_scaling(const bench_scaling_ops *ops, unsigned int maxcount);
+
+#endif
@@ -0,0 +1,197 @@
+//
+//  epoch.c
+//  common
+//
+//  Reader slots, epoch advance and retired lists, see epoch.h.
+//
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "epoch.h"
+
+static pthread_once_t slot_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slot_key;
+static int slot_keyvalid = 0;
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static int slot_free[EPOCH_MAX_THREADS];    /* returned by exited threads */
+/* both written under slot_lock, read without it for a quick "pool empty" */
+static unsigned int slot_freecount = 0;
+static unsigned int slot_next = 0;          /* slots below it were handed out once */
+
+static __thread int thread_slot = -1;
+static __thread unsigned int thread_overflow = 0;  /* pins without a slot */
+
+/* thread exit: the slot goes back to the pool */
+static void epoch_slot_release(void *arg) {
+    pthread_mutex_lock(&slot_lock);
+    slot_free[slot_freecount] = (int)(long)arg - 1;
+    __atomic_store_n(&slot_freecount, slot_freecount + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&slot_lock);
+    thread_slot = -1;
+}
+
+static void epoch_slot_init(void) {
+    slot_keyvalid = pthread_key_create(&slot_key, epoch_slot_release) == 0;
+}
+
+/* reader slot of the calling thread, or -1 while none is free */
+static int epoch_thread_slot(void) {
+    int slot = -1;
+    if (thread_slot >= 0 || thread_overflow > 0) {
+        return thread_slot;     // no switching over while overflow pins are out
+    }
+    pthread_once(&slot_once, epoch_slot_init);
+    if (!slot_keyvalid) {
+        return -1;              // a slot could never be given back
+    }
+    if (__atomic_load_n(&slot_freecount, __ATOMIC_RELAXED) == 0 &&
+        __atomic_load_n(&slot_next, __ATOMIC_RELAXED) == EPOCH_MAX_THREADS) {
+        return -1;
+    }
+    pthread_mutex_lock(&slot_lock);
+    if (slot_freecount > 0) {
+        slot = slot_free[slot_freecount - 1];
+        __atomic_store_n(&slot_freecount, slot_freecount - 1, __ATOMIC_RELAXED);
+    }
+    else if (slot_next < EPOCH_MAX_THREADS) {
+        slot = (int)slot_next;
+        __atomic_store_n(&slot_next, slot_next + 1, __ATOMIC_SEQ_CST);
+    }
+    if (slot >= 0 && pthread_setspecific(slot_key, (void *)(long)(slot + 1)) != 0) {
+        slot_free[slot_freecount] = slot;
+        __atomic_store_n(&slot_freecount, slot_freecount + 1, __ATOMIC_RELAXED);
+        slot = -1;
+    }
+    pthread_mutex_unlock(&slot_lock);
+    thread_slot = slot;
+    return slot;
+}
+
+void epoch_init(epoch_domain *d, unsigned int batch) {
+    unsigned int i;
+    d->epoch = 1;
+    d->overflowreaders = 0;
+    pthread_mutex_init(&d->retirelock, NULL);
+    d->retiredcount = 0;
+    d->batch = batch;
+    d->retired[0] = d->retired[1] = d->retired[2] = NULL;
+    for (i = 0; i < EPOCH_MAX_THREADS; i++) {
+        d->readers[i].state = 0;
+        d->readers[i].depth = 0;
+    }
+}
+
+void epoch_pin(epoch_domain *d) {
+    int slot = epoch_thread_slot();
+    unsigned long epoch;
+    if (slot < 0) {
+        thread_overflow++;
+        __atomic_fetch_add(&d->overflowreaders, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    if (d->readers[slot].depth++ > 0) {
+        return;
+    }
+    epoch = __atomic_load_n(&d->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&d->readers[slot].state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+    /* the announcement must be visible before anything shared is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_unpin(epoch_domain *d) {
+    int slot = thread_slot;
+    if (slot < 0) {
+        thread_overflow--;
+        __atomic_fetch_sub(&d->overflowreaders, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    if (--d->readers[slot].depth == 0) {
+        __atomic_store_n(&d->readers[slot].state, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* Called with retirelock held. Moves the epoch on if every pinned reader
+ * has seen the current one and returns -1, else 0. */
+static int epoch_try_advance(epoch_domain *d) {
+    unsigned long epoch = d->epoch;
+    unsigned long state;
+    unsigned int i, used;
+    if (__atomic_load_n(&d->overflowreaders, __ATOMIC_SEQ_CST) != 0) {
+        return 0;
+    }
+    /* slots from slot_next on were never handed out; one handed out after
+     * this load is pinned at the current epoch or later */
+    used = __atomic_load_n(&slot_next, __ATOMIC_SEQ_CST);
+    for (i = 0; i < used; i++) {
+        state = __atomic_load_n(&d->readers[i].state, __ATOMIC_SEQ_CST);
+        if ((state & 1) && (state >> 1) != epoch) {
+            return 0;
+        }
+    }
+    __atomic_store_n(&d->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    return -1;
+}
+
+static void epoch_free_retired(epoch_retired *r) {
+    epoch_retired *next;
+    for (; r != NULL; r = next) {
+        next = r->next;
+        r->free_fn(r->ctx, r->ptr);
+        free(r);
+    }
+}
+
+/* Called with retirelock held. After a move, what was retired under the
+ * new epoch modulo 3 (two epochs back) is unreachable; it is returned, to
+ * be freed once the lock is dropped. */
+static epoch_retired *epoch_expire(epoch_domain *d) {
+    epoch_retired *expired;
+    unsigned int index;
+    d->retiredcount = 0;
+    if (!epoch_try_advance(d)) {
+        return NULL;
+    }
+    index = d->epoch % 3;
+    expired = d->retired[index];
+    d->retired[index] = NULL;
+    return expired;
+}
+
+int epoch_retire(epoch_domain *d, void *ptr, epoch_free_fn free_fn, void *ctx) {
+    epoch_retired *r = (epoch_retired *)malloc(sizeof(epoch_retired));
+    epoch_retired *expired = NULL;
+    unsigned int index;
+    if (r == NULL) {
+        return 0;
+    }
+    r->free_fn = free_fn;
+    r->ctx = ctx;
+    r->ptr = ptr;
+    pthread_mutex_lock(&d->retirelock);
+    index = d->epoch % 3;
+    r->next = d->retired[index];
+    d->retired[index] = r;
+    if (++d->retiredcount >= d->batch) {
+        expired = epoch_expire(d);
+    }
+    pthread_mutex_unlock(&d->retirelock);
+    epoch_free_retired(expired);
+    return -1;
+}
+
+void epoch_collect(epoch_domain *d) {
+    epoch_retired *expired;
+    pthread_mutex_lock(&d->retirelock);
+    expired = epoch_expire(d);
+    pthread_mutex_unlock(&d->retirelock);
+    epoch_free_retired(expired);
+}
+
+void epoch_destroy(epoch_domain *d) {
+    unsigned int i;
+    for (i = 0; i < 3; i++) {
+        epoch_free_retired(d->retired[i]);
+        d->retired[i] = NULL;
+    }
+    pthread_mutex_destroy(&d->retirelock);
+}
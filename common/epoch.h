@@ -0,0 +1,75 @@
+//
+//  epoch.h
+//  common
+//
+//  Epoch based reclamation shared by the lock-free readers of the
+//  concurrent hashtable, the concurrent red-black tree and the persistent
+//  AVL tree. A reader pins a domain while it walks shared memory; a writer
+//  retires whatever it unlinks, which files it under the current epoch,
+//  and it is freed once the epoch has advanced twice past that, since by
+//  then no pinned reader can still hold a reference. The structures only
+//  supply the function that frees what they retired.
+//
+//  Reader slots come from a process-wide pool. A thread takes one on its
+//  first pin and gives it back when it exits, so only threads alive at the
+//  same time count against EPOCH_MAX_THREADS. A thread that finds the pool
+//  empty pins through a shared counter, which holds the epoch back while
+//  it is non-zero, and asks for a slot again once it has no such pins left.
+//  Threads must unpin everything before they exit.
+//
+
+#ifndef common_epoch_h
+#define common_epoch_h
+
+#include <pthread.h>
+
+#define EPOCH_MAX_THREADS   256
+#define EPOCH_CACHE_LINE    64
+
+/* frees 'ptr', once nobody can reach it; 'ctx' as given to epoch_retire */
+typedef void (*epoch_free_fn)(void *ctx, void *ptr);
+
+typedef struct epoch_retired {
+    struct epoch_retired *next;
+    epoch_free_fn free_fn;
+    void *ctx;
+    void *ptr;
+} epoch_retired;
+
+/* 'state' is (epoch << 1) | 1 while the owning thread is pinned, else 0 */
+typedef struct {
+    unsigned long state;
+    unsigned int depth;
+} __attribute__((aligned(EPOCH_CACHE_LINE))) epoch_reader;
+
+typedef struct {
+    unsigned long epoch;
+    unsigned int overflowreaders;       /* pins of threads without a slot */
+    pthread_mutex_t retirelock;         /* the fields below and advancing */
+    unsigned int retiredcount;          /* since the last collect */
+    unsigned int batch;
+    epoch_retired *retired[3];          /* indexed by retiring epoch % 3 */
+    epoch_reader readers[EPOCH_MAX_THREADS];
+} epoch_domain;
+
+/* epoch_retire collects every 'batch' retirements */
+void epoch_init(epoch_domain *d, unsigned int batch);
+
+/* frees everything still retired; no thread may be pinned any more */
+void epoch_destroy(epoch_domain *d);
+
+/* keep everything reachable now alive until the matching unpin; pins nest */
+void epoch_pin(epoch_domain *d);
+void epoch_unpin(epoch_domain *d);
+
+/* Has free_fn(ctx, ptr) called once no reader pinned now can reach
+ * 'ptr'; that happens inside this or a later epoch_retire or
+ * epoch_collect, on the thread making it. Returns -1, or 0 when out of memory, in which case 'ptr' is
+ * leaked rather than freed under a reader. */
+int epoch_retire(epoch_domain *d, void *ptr, epoch_free_fn free_fn, void *ctx);
+
+/* Moves the epoch on if every pinned reader has seen the current one and
+ * frees what was retired two epochs back. */
+void epoch_collect(epoch_domain *d);
+
+#endif
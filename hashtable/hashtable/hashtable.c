@@ -45,7 +45,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 #include "hashtable.h"
+#include "hashtable_flat.h"
+#include "hashtable_slab.h"
+#include "hashtable_stats.h"
 
 /*
  Credit for primes table: Aaron Krowne
@@ -65,18 +69,36 @@ static const unsigned int primes[] = {
 const unsigned int prime_table_length = sizeof(primes)/sizeof(primes[0]);
 const float max_load_factor = 0.65f;
 
+const unsigned int pow2_min_length = 64;
+const unsigned int pow2_max_length = 1u << 31;
+/* old buckets moved per operation while an incremental expansion runs */
+const unsigned int rehash_step_buckets = 2;
+/* keys in flight per *_many round: enough misses to overlap, few enough
+ * that the prefetched lines are still in L1 when they are used */
+#define HASHTABLE_BATCH 16
+
+static void *default_alloc(void *ctx, size_t size) {
+    return malloc(size);
+}
+
+static void default_free(void *ctx, void *p, size_t size) {
+    free(p);
+}
+
+static const hashtable_allocator default_allocator = {
+    default_alloc, default_free, NULL, NULL
+};
+
 unsigned int hash(hashtable *h, void *k) {
-    /* Aim to protect against poor hash functions by adding logic here
-     * - logic taken from java 1.4 hashtable source */
-    unsigned int i = h->hashfn(k);
-    i += ~(i << 9);
-    i ^=  ((i >> 14) | (i << 18)); /* >>> */
-    i +=  (i << 4);
-    i ^=  ((i >> 10) | (i << 22)); /* >>> */
-    return i;
+    /* Aim to protect against poor hash functions by adding logic here */
+    return hash_mix(h->hashfn(k));
 }
 
 hashtable* hashtable_create(unsigned int minsize, unsigned int (*hashfunction)(void*), int (*key_eq_fn)(void*, void*)) {
+    return hashtable_create_with_options(minsize, hashfunction, key_eq_fn, NULL);
+}
+
+hashtable* hashtable_create_with_options(unsigned int minsize, unsigned int (*hashfunction)(void*), int (*key_eq_fn)(void*, void*), const hashtable_options *options) {
     if (minsize > (1u << 30)) {
         return NULL; // too large
     }
@@ -84,168 +106,497 @@ hashtable* hashtable_create(unsigned int minsize, unsigned int (*hashfunction)(v
     hashtable *h;
     unsigned int pindex;
     unsigned int size;
-    // force size as prime
-    for (pindex = 0; pindex < prime_table_length; pindex++) {
-        if (primes[pindex] > minsize) {
-            size = primes[pindex];
-            break;
+    unsigned int flags = options != NULL ? options->flags : HASHTABLE_CHAINED;
+    if (flags & HASHTABLE_FLAT) {
+        h = (hashtable *)malloc(sizeof(hashtable));
+        if (h == NULL) {
+            return NULL;
+        }
+        h->flags = flags;
+        h->hashfn = hashfunction;
+        h->eqfn = key_eq_fn;
+        h->allocator = default_allocator;
+        h->oldtable = NULL;
+        h->oldlength = 0;
+        h->rehashindex = 0;
+        HASHTABLE_STAT(memset(&h->stats, 0, sizeof(h->stats)));
+        if (!hashtable_flat_init(h, minsize)) {
+            free(h);
+            return NULL;
+        }
+        return h;
+    }
+    if (flags & HASHTABLE_POW2) {
+        // primeindex doubles as log2 of the size
+        for (pindex = 6, size = pow2_min_length; size <= minsize; pindex++) {
+            size <<= 1;
+        }
+    }
+    else {
+        // force size as prime
+        for (pindex = 0; pindex < prime_table_length; pindex++) {
+            if (primes[pindex] > minsize) {
+                size = primes[pindex];
+                break;
+            }
         }
     }
     h = (hashtable *)malloc(sizeof(hashtable));
     if (h == NULL) {
         return NULL;
     }
+    if (flags & HASHTABLE_SLAB) {
+        h->allocator.alloc = hashtable_slab_alloc;
+        h->allocator.free = hashtable_slab_free;
+        h->allocator.release = hashtable_slab_release;
+        h->allocator.ctx = hashtable_slab_create(sizeof(entry));
+        if (h->allocator.ctx == NULL) {
+            free(h);
+            return NULL;
+        }
+    }
+    else {
+        h->allocator = options != NULL && options->allocator != NULL ? *options->allocator : default_allocator;
+    }
     h->table = (entry **)malloc(sizeof(entry *) * size);
-    if (h->table == NULL) {
+    h->occupied = (unsigned long long *)calloc(hashtable_occupied_words(size), sizeof(unsigned long long));
+    if (h->table == NULL || h->occupied == NULL) {
+        if (h->allocator.release != NULL) {
+            h->allocator.release(h->allocator.ctx);
+        }
+        free(h->table);
+        free(h->occupied);
         free(h);
         return NULL;
     }
     memset(h->table, 0, sizeof(entry *) * size);
     h->length = size;
+    h->minlength = size;
     h->primeindex = pindex;
     h->entrycount = 0;
     h->hashfn = hashfunction;
     h->eqfn = key_eq_fn;
     h->loadlimit = (unsigned int)ceil(size * max_load_factor);
+    h->flags = flags;
+    h->oldtable = NULL;
+    h->oldlength = 0;
+    h->rehashindex = 0;
+    h->ctrl = NULL;
+    h->slots = NULL;
+    h->tombstones = 0;
+    HASHTABLE_STAT(memset(&h->stats, 0, sizeof(h->stats)));
     return h;
 }
 
-static int hashtable_expand(hashtable *h) {
+int hashtable_rehash_step(hashtable *h, unsigned int buckets) {
+    struct entry *e, *next;
+    unsigned int index;
+    unsigned int empty_visits = buckets > UINT_MAX / 10 ? UINT_MAX : buckets * 10;
+    if (h->oldtable == NULL) {
+        return 0;
+    }
+    while (buckets > 0 && h->rehashindex < h->oldlength) {
+        e = h->oldtable[h->rehashindex];
+        if (e == NULL) {
+            h->rehashindex++;
+            /* bound the work done on sparse stretches as well */
+            if (--empty_visits == 0) break;
+            continue;
+        }
+        while (e != NULL) {
+            next = e->next;
+            index = indexFor(h->length, e->hash);
+            e->next = h->table[index];
+            h->table[index] = e;
+            hashtable_mark(h->occupied, index);
+            e = next;
+        }
+        h->oldtable[h->rehashindex++] = NULL;
+        buckets--;
+    }
+    if (h->rehashindex < h->oldlength) {
+        return -1;
+    }
+    free(h->oldtable);
+    h->oldtable = NULL;
+    h->oldlength = 0;
+    h->rehashindex = 0;
+    return 0;
+}
+
+/* bucket count at step 'index' of the table's size sequence */
+static unsigned int hashtable_size_at(hashtable *h, unsigned int index) {
+    return (h->flags & HASHTABLE_POW2) ? 1u << index : primes[index];
+}
+
+/* rebuilds the chains into 'newindex' sized buckets, growing or shrinking */
+static int hashtable_resize(hashtable *h, unsigned int newindex) {
     struct entry **newtable;
     struct entry *e;
     struct entry **pE;
+    unsigned long long *newoccupied;
     unsigned int newsize, i, index;
-    /* Check we're not hitting max capacity */
-    // disable: invalid data...
-#pragma warning(disable:6385)
-    if (h->primeindex == (prime_table_length - 1)) return 0;
-    newsize = primes[++(h->primeindex)];
+#ifdef HASHTABLE_STATS
+    unsigned long long start = hashtable_stats_clock();
+#endif
+    /* a migration still in flight has to land before the next one starts */
+    while (hashtable_rehash_step(h, h->oldlength)) ;
+    newsize = hashtable_size_at(h, newindex);
+    newoccupied = (unsigned long long *)calloc(hashtable_occupied_words(newsize), sizeof(unsigned long long));
+    if (newoccupied == NULL) {
+        return 0;
+    }
+    
+    if (h->flags & HASHTABLE_INCREMENTAL) {
+        /* calloc: big zeroed blocks come untouched from the OS, so the
+         * expanding insert does not pay for clearing the new table */
+        newtable = (struct entry **)calloc(newsize, sizeof(struct entry *));
+        if (newtable == NULL) {
+            free(newoccupied);
+            return 0;
+        }
+        /* the bitmap follows the new table; the old one is only drained */
+        free(h->occupied);
+        h->occupied = newoccupied;
+        h->oldtable = h->table;
+        h->oldlength = h->length;
+        h->rehashindex = 0;
+        h->table = newtable;
+        h->length = newsize;
+        h->primeindex = newindex;
+        h->loadlimit = (unsigned int)ceil(newsize * max_load_factor);
+        /* only the switch is timed, the migration is spread over later calls */
+        HASHTABLE_STAT(hashtable_stats_resized(h, start));
+        return -1;
+    }
     
     newtable = (struct entry **)malloc(sizeof(struct entry*) * newsize);
     if (newtable != NULL)
     {
         memset(newtable, 0, newsize * sizeof(struct entry *));
-        for (i = 0; i < h->length; i++) {
+        for (i = hashtable_next_occupied(h, 0, h->length); i < h->length;
+             i = hashtable_next_occupied(h, i + 1, h->length)) {
             while ((e = h->table[i]) != NULL) {
                 h->table[i] = e->next;
                 index = indexFor(newsize,e->hash);
                 e->next = newtable[index];
                 newtable[index] = e;
+                hashtable_mark(newoccupied, index);
             }
         }
         free(h->table);
         h->table = newtable;
     }
-    /* Plan B: realloc instead */
+    /* Plan B: realloc instead, only possible when growing */
     else 
     {
+        if (newsize < h->length) {
+            free(newoccupied);
+            return 0;
+        }
         newtable = (struct entry **)realloc(h->table, newsize * sizeof(struct entry *));
         if (newtable == NULL) { 
-            (h->primeindex)--;
+            free(newoccupied);
             return 0; 
         }
         h->table = newtable;
-        memset(newtable[h->length], 0, newsize - h->length);
+        memset(&newtable[h->length], 0, (newsize - h->length) * sizeof(struct entry *));
         for (i = 0; i < h->length; i++) {
             for (pE = &(newtable[i]), e = *pE; e != NULL; e = *pE) {
                 index = indexFor(newsize,e->hash);
-                *pE = e->next;
-                if (index != i) //== i)
+                if (index == i)
+                {
+                    pE = &(e->next);
+                }
+                else
                 {
-                    //pE = &(e->next);
-                //}
-                //else
-                //{
-                    //*pE = e->next;
+                    *pE = e->next;
                     e->next = newtable[index];
                     newtable[index] = e;
                 }
+                hashtable_mark(newoccupied, index);
             }
         }
     }
+    free(h->occupied);
+    h->occupied = newoccupied;
     h->length = newsize;
+    h->primeindex = newindex;
     h->loadlimit = (unsigned int)ceil(newsize * max_load_factor);
+    HASHTABLE_STAT(hashtable_stats_resized(h, start));
     return -1;
 }
 
-int hashtable_set(hashtable *h, void *k, void *v) {
+static int hashtable_expand(hashtable *h) {
+    /* Check we're not hitting max capacity */
+    // disable: invalid data...
+#pragma warning(disable:6385)
+    if (h->flags & HASHTABLE_POW2) {
+        if (h->length == pow2_max_length) return 0;
+    }
+    else {
+        if (h->primeindex == (prime_table_length - 1)) return 0;
+    }
+    return hashtable_resize(h, h->primeindex + 1);
+}
+
+/* smallest size step not below 'floor' buckets that keeps 'count' entries
+ * under the load limit */
+static unsigned int hashtable_fit_index(hashtable *h, unsigned int count, unsigned int floor) {
+    unsigned int index = h->primeindex;
+    unsigned int lowest = (h->flags & HASHTABLE_POW2) ? 6 : 0;
+    unsigned int size;
+    while (index > lowest) {
+        size = hashtable_size_at(h, index - 1);
+        if (size < floor || (unsigned int)ceil(size * max_load_factor) < count) break;
+        index--;
+    }
+    return index;
+}
+
+/* Hysteresis: shrink only below a quarter of the load limit, and leave
+ * room to double before the next expansion. */
+static void hashtable_maybe_shrink(hashtable *h) {
+    unsigned int index;
+    if ((h->flags & HASHTABLE_NO_SHRINK) || h->oldtable != NULL ||
+        h->length <= h->minlength || h->entrycount >= h->loadlimit / 4) {
+        return;
+    }
+    if (h->flags & HASHTABLE_FLAT) {
+        index = hashtable_flat_fit(2 * h->entrycount, h->minlength);
+        if (index < h->length) {
+            hashtable_flat_resize(h, index);
+        }
+        return;
+    }
+    index = hashtable_fit_index(h, 2 * h->entrycount, h->minlength);
+    if (index != h->primeindex) {
+        hashtable_resize(h, index);
+    }
+}
+
+int hashtable_compact(hashtable *h) {
+    unsigned int index;
+    if (h->flags & HASHTABLE_FLAT) {
+        /* also rebuilds at the same size, to drop the tombstones */
+        return hashtable_flat_resize(h, hashtable_flat_fit(h->entrycount, 0));
+    }
+    while (hashtable_rehash_step(h, h->oldlength)) ;
+    index = hashtable_fit_index(h, h->entrycount, 0);
+    if (index == h->primeindex) {
+        return -1;
+    }
+    if (!hashtable_resize(h, index)) {
+        return 0;
+    }
+    while (hashtable_rehash_step(h, h->oldlength)) ;
+    return -1;
+}
+
+int hashtable_reserve(hashtable *h, unsigned int count) {
+    unsigned int index, last;
+    if (h->flags & HASHTABLE_FLAT) {
+        index = hashtable_flat_fit(count, h->length);
+        return index == h->length ? -1 : hashtable_flat_resize(h, index);
+    }
+    while (hashtable_rehash_step(h, h->oldlength)) ;
+    index = h->primeindex;
+    last = (h->flags & HASHTABLE_POW2) ? 31 : prime_table_length - 1;
+    while (index < last && (unsigned int)ceil(hashtable_size_at(h, index) * max_load_factor) < count) {
+        index++;
+    }
+    if (index == h->primeindex) {
+        return -1;
+    }
+    if (!hashtable_resize(h, index)) {
+        return 0;
+    }
+    while (hashtable_rehash_step(h, h->oldlength)) ;
+    return -1;
+}
+
+/* link pointing at the entry for 'k' in the chain at 'pE', or NULL */
+static struct entry **hashtable_find_link(hashtable *h, struct entry **pE, void *k, unsigned int hashvalue) {
     struct entry *e;
-    unsigned int hashvalue, index;
-    hashvalue = hash(h,k);
-    index = indexFor(h->length,hashvalue);
-    e = h->table[index];
-    while (e != NULL)
-    {
+#ifdef HASHTABLE_STATS
+    unsigned int length = 0;
+#endif
+    while ((e = *pE) != NULL) {
+        HASHTABLE_STAT(length++);
+        HASHTABLE_STAT(hashvalue == e->hash ? h->stats.eqfncalls++ : h->stats.hashskips++);
         /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->hash) && (h->eqfn(k, e->key)))
-        {
-            free(e->value);
-            e->value = v;
-            return -1;
+        if ((hashvalue == e->hash) && (h->eqfn(k, e->key))) {
+            HASHTABLE_STAT(hashtable_stats_probe(&h->stats, length));
+            return pE;
         }
-        e = e->next;
+        pE = &(e->next);
+    }
+    HASHTABLE_STAT(hashtable_stats_probe(&h->stats, length));
+    return NULL;
+}
+
+/* looks in the new table first, then in the not yet migrated old bucket */
+static struct entry **hashtable_lookup(hashtable *h, void *k, unsigned int hashvalue) {
+    struct entry **pE;
+    pE = hashtable_find_link(h, &(h->table[indexFor(h->length, hashvalue)]), k, hashvalue);
+    if (pE == NULL && h->oldtable != NULL) {
+        pE = hashtable_find_link(h, &(h->oldtable[indexFor(h->oldlength, hashvalue)]), k, hashvalue);
+    }
+    return pE;
+}
+
+static int hashtable_set_hashed(hashtable *h, void *k, void *v, unsigned int hashvalue) {
+    struct entry *e;
+    struct entry **pE;
+    unsigned int index;
+    pE = hashtable_lookup(h, k, hashvalue);
+    if (pE != NULL)
+    {
+        e = *pE;
+        free(e->value);
+        e->value = v;
+        return -1;
     }
     
     if (++(h->entrycount) > h->loadlimit) {
         hashtable_expand(h);
     }
-    e = (struct entry *)malloc(sizeof(struct entry));
+    e = (struct entry *)h->allocator.alloc(h->allocator.ctx, sizeof(struct entry));
     if (e == NULL) { 
         --(h->entrycount); 
         return 0; 
     }
-    e->hash = hash(h,k);
+    e->hash = hashvalue;
     index = indexFor(h->length, e->hash);
     e->key = k;
     e->value = v;
     e->next = h->table[index];
     h->table[index] = e;
+    hashtable_mark(h->occupied, index);
     return -1;
 }
 
+int hashtable_set(hashtable *h, void *k, void *v) {
+    if (h->flags & HASHTABLE_FLAT) {
+        return hashtable_flat_set(h, k, v);
+    }
+    if (h->oldtable != NULL) {
+        hashtable_rehash_step(h, rehash_step_buckets);
+    }
+    return hashtable_set_hashed(h, k, v, hash(h, k));
+}
+
 void* hashtable_get(hashtable *h, void *k) {
+    if (h->flags & HASHTABLE_FLAT) {
+        return hashtable_flat_get(h, k);
+    }
+    struct entry **pE;
+    if (h->oldtable != NULL) {
+        hashtable_rehash_step(h, rehash_step_buckets);
+    }
+    pE = hashtable_lookup(h, k, hash(h, k));
+    return pE == NULL ? NULL : (*pE)->value;
+}
+
+/* first two stages of a batch: hash everything and prefetch its buckets,
+ * then load the bucket heads (or matching flat slots) and prefetch those */
+static void hashtable_prefetch_batch(hashtable *h, void **keys, unsigned int *hashes, unsigned int n) {
+    unsigned int i;
     struct entry *e;
-    unsigned int hashvalue, index;
-    hashvalue = hash(h, k);
-    index = indexFor(h->length,hashvalue);
-    e = h->table[index];
-    while (e != NULL) {
-        /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->hash) && (h->eqfn(k, e->key))) 
-            return e->value;
-        e = e->next;
+    for (i = 0; i < n; i++) {
+        hashes[i] = hash(h, keys[i]);
+        if (h->flags & HASHTABLE_FLAT)
+            flat_prefetch_group(h, hashes[i]);
+        else
+            __builtin_prefetch(&(h->table[indexFor(h->length, hashes[i])]));
+    }
+    for (i = 0; i < n; i++) {
+        if (h->flags & HASHTABLE_FLAT) {
+            flat_prefetch_slot(h, hashes[i]);
+        }
+        else if ((e = h->table[indexFor(h->length, hashes[i])]) != NULL) {
+            __builtin_prefetch(e);
+        }
+    }
+}
+
+void hashtable_get_many(hashtable *h, void **keys, void **values, unsigned int n) {
+    unsigned int hashes[HASHTABLE_BATCH];
+    unsigned int i, j, batch;
+    struct entry **pE;
+    for (i = 0; i < n; i += batch) {
+        batch = n - i < HASHTABLE_BATCH ? n - i : HASHTABLE_BATCH;
+        if (h->oldtable != NULL) {
+            hashtable_rehash_step(h, rehash_step_buckets);
+        }
+        hashtable_prefetch_batch(h, keys + i, hashes, batch);
+        for (j = 0; j < batch; j++) {
+            if (h->flags & HASHTABLE_FLAT) {
+                unsigned int index = hashtable_flat_find(h, keys[i + j], hashes[j]);
+                values[i + j] = index == h->length ? NULL : h->slots[index].value;
+            }
+            else {
+                pE = hashtable_lookup(h, keys[i + j], hashes[j]);
+                values[i + j] = pE == NULL ? NULL : (*pE)->value;
+            }
+        }
     }
-    return NULL;
+}
+
+unsigned int hashtable_set_many(hashtable *h, void **keys, void **values, unsigned int n) {
+    unsigned int hashes[HASHTABLE_BATCH];
+    unsigned int i, j, batch, stored = 0;
+    for (i = 0; i < n; i += batch) {
+        batch = n - i < HASHTABLE_BATCH ? n - i : HASHTABLE_BATCH;
+        if (h->oldtable != NULL) {
+            hashtable_rehash_step(h, rehash_step_buckets);
+        }
+        /* an expansion half way through only makes the later prefetches moot */
+        hashtable_prefetch_batch(h, keys + i, hashes, batch);
+        for (j = 0; j < batch; j++) {
+            if (h->flags & HASHTABLE_FLAT) {
+                if (hashtable_flat_set_hashed(h, keys[i + j], values[i + j], hashes[j]))
+                    stored++;
+            }
+            else if (hashtable_set_hashed(h, keys[i + j], values[i + j], hashes[j])) {
+                stored++;
+            }
+        }
+    }
+    return stored;
 }
 
 void* hashtable_remove(hashtable *h, void *k) {
-    // TODO: consider compacting the table when the load factor drops enough,
-    //       or provide a 'compact' method.
-    
     struct entry *e;
     struct entry **pE;
+    unsigned int index;
     void *v;
-    unsigned int hashvalue, index;
     
-    hashvalue = hash(h,k);
-    index = indexFor(h->length, hash(h, k));
-    pE = &(h->table[index]);
+    if (h->flags & HASHTABLE_FLAT) {
+        v = hashtable_flat_remove(h, k);
+        hashtable_maybe_shrink(h);
+        return v;
+    }
+    if (h->oldtable != NULL) {
+        hashtable_rehash_step(h, rehash_step_buckets);
+    }
+    pE = hashtable_lookup(h, k, hash(h, k));
+    if (pE == NULL) {
+        return NULL;
+    }
     e = *pE;
-    while (e != NULL) {
-        /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->hash) && (h->eqfn(k, e->key)))
-        {
-            *pE = e->next;
-            h->entrycount--;
-            v = e->value;
-            free(e->key);
-            free(e);
-            return v;
-        }
-        pE = &(e->next);
-        e = e->next;
+    *pE = e->next;
+    /* the entry may have come from the old table; only the new one is tracked */
+    index = indexFor(h->length, e->hash);
+    if (h->table[index] == NULL) {
+        hashtable_unmark(h->occupied, index);
     }
-    return NULL;
+    h->entrycount--;
+    v = e->value;
+    free(e->key);
+    h->allocator.free(h->allocator.ctx, e, sizeof(struct entry));
+    hashtable_maybe_shrink(h);
+    return v;
 }
 
 unsigned int hashtable_count(hashtable *h) {
@@ -254,35 +605,35 @@ unsigned int hashtable_count(hashtable *h) {
 
 void hashtable_destroy(hashtable *h, int free_values) {
     unsigned int i;
+    int release;
     struct entry *e, *f;
     struct entry **table = h->table;
-    if (free_values)
-    {
-        for (i = 0; i < h->length; i++)
-        {
-            e = table[i];
-            while (NULL != e) { 
-                f = e; 
-                e = e->next; 
-                free(f->key); 
-                free(f->value); 
-                free(f); 
-            }
-        }
+    if (h->flags & HASHTABLE_FLAT) {
+        hashtable_flat_destroy(h, free_values);
+        free(h);
+        return;
     }
-    else
+    while (hashtable_rehash_step(h, h->oldlength)) ;
+    table = h->table;
+    /* an arena drops all entries at once below, only keys/values are left */
+    release = h->allocator.release != NULL;
+    for (i = hashtable_next_occupied(h, 0, h->length); i < h->length;
+         i = hashtable_next_occupied(h, i + 1, h->length))
     {
-        for (i = 0; i < h->length; i++)
-        {
-            e = table[i];
-            while (NULL != e) { 
-                f = e; 
-                e = e->next; 
-                free(f->key);
-                free(f); 
-            }
+        e = table[i];
+        while (NULL != e) { 
+            f = e; 
+            e = e->next; 
+            free(f->key); 
+            if (free_values)
+                free(f->value); 
+            if (!release)
+                h->allocator.free(h->allocator.ctx, f, sizeof(struct entry)); 
         }
     }
+    if (release)
+        h->allocator.release(h->allocator.ctx);
     free(h->table);
+    free(h->occupied);
     free(h);
-}
\ No newline at end of file
+}
@@ -44,6 +44,8 @@
 #ifndef hashtable_hashtable_h
 #define hashtable_hashtable_h
 
+#include <stddef.h>
+
 typedef struct entry {
     void *key;
     void *value;
@@ -51,32 +53,180 @@ typedef struct entry {
     struct entry *next;
 } entry;
 
+#ifdef HASHTABLE_STATS
+#define HASHTABLE_STATS_PROBES  16
+
+/* Counters kept when built with -DHASHTABLE_STATS, see hashtable_stats.h.
+ * The flag changes the layout of 'hashtable', so the library and every
+ * file using it must be built with the same setting. */
+typedef struct {
+    unsigned long long lookups;     /* chain walks, or flat probe sequences */
+    unsigned long long probes[HASHTABLE_STATS_PROBES]; /* by length; the last counts that or longer */
+    unsigned long long probetotal;
+    unsigned int probemax;
+    unsigned long long eqfncalls;
+    unsigned long long hashskips;   /* candidates rejected on the stored hash alone */
+    unsigned long long resizes;
+    unsigned long long resizens;
+    unsigned long long resizemaxns;
+} hashtable_stats;
+
+#define HASHTABLE_STAT(stmt)    do { stmt; } while (0)
+#else
+#define HASHTABLE_STAT(stmt)    do { } while (0)
+#endif
+
+/* slot of a HASHTABLE_FLAT table, stored inline in the slot array */
+typedef struct flat_slot {
+    void *key;
+    void *value;
+    unsigned int hash;
+} flat_slot;
+
+typedef enum {
+    HASHTABLE_CHAINED   = 0,        /* bucket array of 'entry' lists (default) */
+    HASHTABLE_FLAT      = 1 << 0,   /* open addressing, 16-slot control groups */
+    HASHTABLE_POW2      = 1 << 1,   /* power-of-two bucket counts, mask indexing */
+    HASHTABLE_INCREMENTAL = 1 << 2, /* chained only: spread expansion over later calls */
+    HASHTABLE_SLAB      = 1 << 3,   /* chained only: entries come from a table-owned arena */
+    HASHTABLE_NO_SHRINK = 1 << 4    /* keep the peak size; remove never rehashes */
+} hashtable_flags;
+
+/* Where chained tables get their entries from. 'release', when set, must
+ * drop everything allocated through 'ctx'; destroy then skips the per-entry
+ * frees, so only give it for a ctx that serves this one table. */
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);
+    void (*free)(void *ctx, void *p, size_t size);
+    void (*release)(void *ctx);
+    void *ctx;
+} hashtable_allocator;
+
+typedef struct {
+    unsigned int flags;
+    const hashtable_allocator *allocator;   /* NULL: malloc/free, or the slab */
+} hashtable_options;
+
 typedef struct {
     unsigned int length;
     struct entry **table;
+    unsigned long long *occupied;   /* chained only: bit i is set while table[i] is not empty */
     unsigned int entrycount;
     unsigned int loadlimit;
     unsigned int primeindex;
+    unsigned int minlength;         /* creation size, the floor for shrinking */
     unsigned int (*hashfn)(void *k);
     int (*eqfn)(void *k1, void *k2);
+    unsigned int flags;
+    hashtable_allocator allocator;
+    /* HASHTABLE_INCREMENTAL only: buckets below 'rehashindex' have moved to 'table' */
+    struct entry **oldtable;
+    unsigned int oldlength;
+    unsigned int rehashindex;
+    /* HASHTABLE_FLAT only: 'length' slots and one control byte per slot */
+    signed char *ctrl;
+    struct flat_slot *slots;
+    unsigned int tombstones;
+#ifdef HASHTABLE_STATS
+    hashtable_stats stats;
+#endif
 } hashtable;
 
+#ifdef HASHTABLE_STATS
+/* one lookup that visited 'length' entries (chained) or groups (flat) */
+static inline void hashtable_stats_probe(hashtable_stats *s, unsigned int length) {
+    s->lookups++;
+    s->probes[length < HASHTABLE_STATS_PROBES ? length : HASHTABLE_STATS_PROBES - 1]++;
+    s->probetotal += length;
+    if (length > s->probemax)
+        s->probemax = length;
+}
+#endif
+
+/* murmur3 fmix32 finalizer: every input bit affects every output bit,
+ * so masking off the low bits of a power-of-two table stays fair */
+static inline unsigned int hash_mix(unsigned int i) {
+    i ^= i >> 16;
+    i *= 0x85ebca6bu;
+    i ^= i >> 13;
+    i *= 0xc2b2ae35u;
+    i ^= i >> 16;
+    return i;
+}
+
 unsigned int hash(hashtable *h, void *k);
 
+/* 64-bit words of an occupancy bitmap for 'length' buckets */
+static inline size_t hashtable_occupied_words(unsigned int length) {
+    return ((size_t)length + 63) / 64;
+}
+
+static inline void hashtable_mark(unsigned long long *occupied, unsigned int index) {
+    occupied[index >> 6] |= 1ull << (index & 63);
+}
+
+static inline void hashtable_unmark(unsigned long long *occupied, unsigned int index) {
+    occupied[index >> 6] &= ~(1ull << (index & 63));
+}
+
+/* first non-empty bucket in [index, end), or 'end'; skips 64 empty buckets per word */
+static inline unsigned int hashtable_next_occupied(hashtable *h, unsigned int index, unsigned int end) {
+    unsigned long long word;
+    unsigned int w;
+    if (index >= end)
+        return end;
+    w = index >> 6;
+    word = h->occupied[w] & (~0ull << (index & 63));
+    while (word == 0) {
+        if (((unsigned long long)++w << 6) >= end)
+            return end;
+        word = h->occupied[w];
+    }
+    index = (w << 6) + (unsigned int)__builtin_ctzll(word);
+    return index < end ? index : end;
+}
+
+/* primes are never powers of two, so the length alone picks mask or modulo */
 static inline unsigned int indexFor(unsigned int tablelength, unsigned int hashvalue) {
+    if ((tablelength & (tablelength - 1)) == 0)
+        return (hashvalue & (tablelength - 1));
     return (hashvalue % tablelength);
 }
 
 hashtable* hashtable_create(unsigned int minsize, unsigned int (*hashfunction)(void*), int (*key_eq_fn)(void*, void*));
 
+hashtable* hashtable_create_with_options(unsigned int minsize, unsigned int (*hashfunction)(void*), int (*key_eq_fn)(void*, void*), const hashtable_options *options);
+
 int hashtable_set(hashtable *h, void *k, void *v);
 
 void* hashtable_get(hashtable *h, void *k);
 
+/* Batched forms of get/set. The whole batch is hashed and its buckets
+ * prefetched before any chain is walked, so the cache misses of
+ * different keys overlap instead of queueing up one after another.
+ * get_many stores each value (or NULL) in values[i]; set_many returns
+ * how many pairs were stored. */
+void hashtable_get_many(hashtable *h, void **keys, void **values, unsigned int n);
+
+unsigned int hashtable_set_many(hashtable *h, void **keys, void **values, unsigned int n);
+
+/* shrinks the table once it falls below a quarter of its load limit,
+ * unless HASHTABLE_NO_SHRINK is set */
 void* hashtable_remove(hashtable *h, void *k);
 
+/* shrinks to the smallest size that holds the current entries, even below
+ * the creation size, and finishes any pending incremental migration */
+int hashtable_compact(hashtable *h);
+
+/* grows the table once so that 'count' entries fit without another
+ * expansion; never shrinks, and lands any pending migration */
+int hashtable_reserve(hashtable *h, unsigned int count);
+
 unsigned int hashtable_count(hashtable *h);
 
+/* moves up to 'buckets' old buckets; returns -1 while a migration is pending */
+int hashtable_rehash_step(hashtable *h, unsigned int buckets);
+
 void hashtable_destroy(hashtable *h, int free_values);
 
 #endif
@@ -0,0 +1,258 @@
+//
+//  hashtable_concurrent.c
+//  hashtable
+//
+//  Striped-lock writers, epoch protected lock-free readers, see
+//  hashtable_concurrent.h.
+//
+
+#include <stdlib.h>
+#include "hashtable_concurrent.h"
+
+#define CHT_MIN_LENGTH      64
+#define CHT_MAX_LENGTH      (1u << 31)
+#define CHT_RECLAIM_BATCH   64          /* retirements between reclaim attempts */
+
+static unsigned int chashtable_loadlimit(unsigned int length) {
+    return length - length / 4;
+}
+
+static chashtable_table *chashtable_table_create(unsigned int length) {
+    chashtable_table *t = (chashtable_table *)malloc(sizeof(chashtable_table));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->buckets = (struct entry **)calloc(length, sizeof(struct entry *));
+    if (t->buckets == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->length = length;
+    return t;
+}
+
+chashtable* chashtable_create(unsigned int minsize, unsigned int (*hashfunction)(void*), int (*key_eq_fn)(void*, void*)) {
+    chashtable *h;
+    unsigned int length = CHT_MIN_LENGTH;
+    unsigned int i;
+    if (minsize > (1u << 30)) {
+        return NULL; // too large
+    }
+    while (chashtable_loadlimit(length) < minsize) {
+        length <<= 1;
+    }
+    if (posix_memalign((void **)&h, CHASHTABLE_CACHE_LINE, sizeof(chashtable)) != 0) {
+        return NULL;
+    }
+    h->table = chashtable_table_create(length);
+    if (h->table == NULL) {
+        free(h);
+        return NULL;
+    }
+    h->entrycount = 0;
+    h->hashfn = hashfunction;
+    h->eqfn = key_eq_fn;
+    pthread_mutex_init(&h->resizelock, NULL);
+    for (i = 0; i < CHASHTABLE_STRIPES; i++) {
+        pthread_mutex_init(&h->stripes[i].lock, NULL);
+    }
+    epoch_init(&h->readers, CHT_RECLAIM_BATCH);
+    return h;
+}
+
+void chashtable_pin(chashtable *h) {
+    epoch_pin(&h->readers);
+}
+
+void chashtable_unpin(chashtable *h) {
+    epoch_unpin(&h->readers);
+}
+
+/* frees the entries and buckets of 't', not the keys and values */
+static void chashtable_table_free(chashtable_table *t) {
+    struct entry *e, *f;
+    unsigned int i;
+    for (i = 0; i < t->length; i++) {
+        for (e = t->buckets[i]; e != NULL; e = f) {
+            f = e->next;
+            free(e);
+        }
+    }
+    free(t->buckets);
+    free(t);
+}
+
+/* epoch_free_fns: an overwritten value, an unlinked entry with its key
+ * and value, and a table replaced by resize (its keys and values live on) */
+static void chashtable_free_value(void *ctx, void *ptr) {
+    free(ptr);
+}
+
+static void chashtable_free_entry(void *ctx, void *ptr) {
+    struct entry *e = (struct entry *)ptr;
+    free(e->key);
+    free(e->value);
+    free(e);
+}
+
+static void chashtable_free_table(void *ctx, void *ptr) {
+    chashtable_table_free((chashtable_table *)ptr);
+}
+
+/* Doubles the table. All stripes are held, so the chains are stable;
+ * they are copied rather than relinked because readers may still be
+ * walking the old ones. */
+static void chashtable_resize(chashtable *h) {
+    chashtable_table *t, *nt;
+    struct entry *e, *copy;
+    unsigned int i, index;
+    if (pthread_mutex_trylock(&h->resizelock) != 0) {
+        return; // somebody else is already on it
+    }
+    for (i = 0; i < CHASHTABLE_STRIPES; i++) {
+        pthread_mutex_lock(&h->stripes[i].lock);
+    }
+    t = h->table;
+    nt = NULL;
+    if (t->length < CHT_MAX_LENGTH &&
+        __atomic_load_n(&h->entrycount, __ATOMIC_RELAXED) > chashtable_loadlimit(t->length)) {
+        nt = chashtable_table_create(t->length << 1);
+    }
+    for (i = 0; nt != NULL && i < t->length; i++) {
+        for (e = t->buckets[i]; e != NULL; e = e->next) {
+            copy = (struct entry *)malloc(sizeof(struct entry));
+            if (copy == NULL) {
+                /* give up, the old table stays in place */
+                chashtable_table_free(nt);
+                nt = NULL;
+                break;
+            }
+            *copy = *e;
+            index = e->hash & (nt->length - 1);
+            copy->next = nt->buckets[index];
+            nt->buckets[index] = copy;
+        }
+    }
+    if (nt != NULL) {
+        __atomic_store_n(&h->table, nt, __ATOMIC_RELEASE);
+    }
+    for (i = CHASHTABLE_STRIPES; i-- > 0; ) {
+        pthread_mutex_unlock(&h->stripes[i].lock);
+    }
+    if (nt != NULL) {
+        epoch_retire(&h->readers, t, chashtable_free_table, NULL);
+    }
+    pthread_mutex_unlock(&h->resizelock);
+}
+
+int chashtable_set(chashtable *h, void *k, void *v) {
+    unsigned int hashvalue = hash_mix(h->hashfn(k));
+    pthread_mutex_t *lock = &h->stripes[hashvalue & (CHASHTABLE_STRIPES - 1)].lock;
+    chashtable_table *t;
+    struct entry *e, **bucket;
+    unsigned int loadlimit;
+    void *old;
+    pthread_mutex_lock(lock);
+    t = h->table;
+    bucket = &t->buckets[hashvalue & (t->length - 1)];
+    for (e = *bucket; e != NULL; e = e->next) {
+        /* Check hash value to short circuit heavier comparison */
+        if ((hashvalue == e->hash) && (h->eqfn(k, e->key)))
+        {
+            old = e->value;
+            __atomic_store_n(&e->value, v, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(lock);
+            if (old != NULL) {
+                epoch_retire(&h->readers, old, chashtable_free_value, NULL);
+            }
+            return -1;
+        }
+    }
+    e = (struct entry *)malloc(sizeof(struct entry));
+    if (e == NULL) {
+        pthread_mutex_unlock(lock);
+        return 0;
+    }
+    e->key = k;
+    e->value = v;
+    e->hash = hashvalue;
+    e->next = *bucket;
+    /* publish a fully built entry to readers */
+    __atomic_store_n(bucket, e, __ATOMIC_RELEASE);
+    /* 't' may be retired by a resize as soon as the stripe is released */
+    loadlimit = chashtable_loadlimit(t->length);
+    pthread_mutex_unlock(lock);
+    if (__atomic_add_fetch(&h->entrycount, 1, __ATOMIC_RELAXED) > loadlimit) {
+        chashtable_resize(h);
+    }
+    return -1;
+}
+
+void* chashtable_get(chashtable *h, void *k) {
+    unsigned int hashvalue = hash_mix(h->hashfn(k));
+    chashtable_table *t;
+    struct entry *e;
+    void *v = NULL;
+    chashtable_pin(h);
+    t = __atomic_load_n(&h->table, __ATOMIC_ACQUIRE);
+    e = __atomic_load_n(&t->buckets[hashvalue & (t->length - 1)], __ATOMIC_ACQUIRE);
+    while (e != NULL) {
+        if ((hashvalue == e->hash) && (h->eqfn(k, e->key))) {
+            v = __atomic_load_n(&e->value, __ATOMIC_ACQUIRE);
+            break;
+        }
+        e = __atomic_load_n(&e->next, __ATOMIC_ACQUIRE);
+    }
+    chashtable_unpin(h);
+    return v;
+}
+
+int chashtable_remove(chashtable *h, void *k) {
+    unsigned int hashvalue = hash_mix(h->hashfn(k));
+    pthread_mutex_t *lock = &h->stripes[hashvalue & (CHASHTABLE_STRIPES - 1)].lock;
+    chashtable_table *t;
+    struct entry *e, **pE;
+    pthread_mutex_lock(lock);
+    t = h->table;
+    pE = &t->buckets[hashvalue & (t->length - 1)];
+    for (e = *pE; e != NULL; pE = &e->next, e = *pE) {
+        if ((hashvalue == e->hash) && (h->eqfn(k, e->key))) {
+            /* readers already on 'e' still find the rest of the chain */
+            __atomic_store_n(pE, e->next, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(lock);
+            __atomic_fetch_sub(&h->entrycount, 1, __ATOMIC_RELAXED);
+            epoch_retire(&h->readers, e, chashtable_free_entry, NULL);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+unsigned int chashtable_count(chashtable *h) {
+    return __atomic_load_n(&h->entrycount, __ATOMIC_RELAXED);
+}
+
+void chashtable_destroy(chashtable *h, int free_values) {
+    chashtable_table *t = h->table;
+    struct entry *e, *f;
+    unsigned int i;
+    for (i = 0; i < t->length; i++) {
+        for (e = t->buckets[i]; e != NULL; e = f) {
+            f = e->next;
+            free(e->key);
+            if (free_values) {
+                free(e->value);
+            }
+            free(e);
+        }
+    }
+    free(t->buckets);
+    free(t);
+    epoch_destroy(&h->readers);
+    pthread_mutex_destroy(&h->resizelock);
+    for (i = 0; i < CHASHTABLE_STRIPES; i++) {
+        pthread_mutex_destroy(&h->stripes[i].lock);
+    }
+    free(h);
+}
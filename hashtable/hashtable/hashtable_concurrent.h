@@ -0,0 +1,68 @@
+//
+//  hashtable_concurrent.h
+//  hashtable
+//
+//  Thread-safe chained hashtable built on the same 'entry' chains and
+//  hash_mix() as hashtable.h. Writers lock one of CHASHTABLE_STRIPES
+//  stripes (bucket index modulo the stripe count); readers take no lock
+//  and walk the chains inside an epoch. Memory unlinked by writers, and
+//  whole tables replaced by a resize, are freed only once every reader
+//  that could still see them has left its epoch (see common/epoch.h).
+//
+//  Keys and values are owned by the table as in hashtable.h: an
+//  overwritten value, and a removed entry's key and value, are freed after
+//  the grace period. A value returned by chashtable_get is only guaranteed
+//  to stay alive while the calling thread holds chashtable_pin().
+//
+
+#ifndef hashtable_hashtable_concurrent_h
+#define hashtable_hashtable_concurrent_h
+
+#include <pthread.h>
+#include "hashtable.h"
+#include "../../common/epoch.h"
+
+#define CHASHTABLE_STRIPES      64      /* power of two, <= minimum length */
+#define CHASHTABLE_CACHE_LINE   64
+
+typedef struct {
+    unsigned int length;                /* power of two */
+    struct entry **buckets;
+} chashtable_table;
+
+typedef struct {
+    pthread_mutex_t lock;
+} __attribute__((aligned(CHASHTABLE_CACHE_LINE))) chashtable_stripe;
+
+typedef struct {
+    chashtable_table *table;            /* replaced as a whole by resize */
+    unsigned int entrycount;
+    unsigned int (*hashfn)(void *k);
+    int (*eqfn)(void *k1, void *k2);
+    pthread_mutex_t resizelock;
+    chashtable_stripe stripes[CHASHTABLE_STRIPES];
+    epoch_domain readers;               /* and what writers unlinked */
+} chashtable;
+
+chashtable* chashtable_create(unsigned int minsize, unsigned int (*hashfunction)(void*), int (*key_eq_fn)(void*, void*));
+
+int chashtable_set(chashtable *h, void *k, void *v);
+
+void* chashtable_get(chashtable *h, void *k);
+
+/* -1 when removed, 0 when absent. Unlike hashtable_remove the value is
+ * not handed back: readers may still hold it, so the table frees it with
+ * the key after the grace period. */
+int chashtable_remove(chashtable *h, void *k);
+
+unsigned int chashtable_count(chashtable *h);
+
+/* keep everything read until the matching unpin alive; pins nest */
+void chashtable_pin(chashtable *h);
+
+void chashtable_unpin(chashtable *h);
+
+/* no other thread may use the table any more */
+void chashtable_destroy(chashtable *h, int free_values);
+
+#endif
@@ -0,0 +1,234 @@
+//
+//  hashtable_flat.c
+//  hashtable
+//
+//  Open addressing backend behind HASHTABLE_FLAT, see hashtable_flat.h.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable_flat.h"
+#include "hashtable_stats.h"
+
+#define FLAT_MAX_LENGTH     (1u << 31)
+
+/* 7/8 max load: group probing keeps long probe sequences cheap */
+static unsigned int flat_loadlimit(unsigned int length) {
+    return length - length / 8;
+}
+
+static int flat_alloc(hashtable *h, unsigned int length) {
+    signed char *ctrl = (signed char *)malloc(length);
+    flat_slot *slots = (flat_slot *)malloc(sizeof(flat_slot) * length);
+    if (ctrl == NULL || slots == NULL) {
+        free(ctrl);
+        free(slots);
+        return 0;
+    }
+    memset(ctrl, FLAT_EMPTY, length);
+    h->ctrl = ctrl;
+    h->slots = slots;
+    h->length = length;
+    h->loadlimit = flat_loadlimit(length);
+    h->tombstones = 0;
+    return -1;
+}
+
+/* first EMPTY or DELETED slot on the probe sequence of 'hashvalue' */
+static unsigned int flat_find_free(const signed char *ctrl, unsigned int length, unsigned int hashvalue) {
+    unsigned int groupmask = length / FLAT_GROUP_WIDTH - 1;
+    unsigned int g = flat_h1(hashvalue) & groupmask;
+    unsigned int step = 0, m;
+    while ((m = flat_group_match_free(ctrl + g * FLAT_GROUP_WIDTH)) == 0) {
+        g = (g + ++step) & groupmask;
+    }
+    return g * FLAT_GROUP_WIDTH + flat_lowest_bit(m);
+}
+
+int hashtable_flat_resize(hashtable *h, unsigned int newlength) {
+    signed char *oldctrl = h->ctrl;
+    flat_slot *oldslots = h->slots;
+    unsigned int oldlength = h->length;
+    unsigned int i, j;
+#ifdef HASHTABLE_STATS
+    unsigned long long start = hashtable_stats_clock();
+#endif
+    if (!flat_alloc(h, newlength)) {
+        return 0;
+    }
+    for (i = 0; i < oldlength; i++) {
+        if (oldctrl[i] >= 0) {
+            j = flat_find_free(h->ctrl, newlength, oldslots[i].hash);
+            h->ctrl[j] = oldctrl[i];
+            h->slots[j] = oldslots[i];
+        }
+    }
+    free(oldctrl);
+    free(oldslots);
+    HASHTABLE_STAT(hashtable_stats_resized(h, start));
+    return -1;
+}
+
+unsigned int hashtable_flat_fit(unsigned int count, unsigned int floor) {
+    unsigned int length = FLAT_GROUP_WIDTH;
+    while (length < floor || flat_loadlimit(length) < count) {
+        length <<= 1;
+    }
+    return length;
+}
+
+int hashtable_flat_init(hashtable *h, unsigned int minsize) {
+    unsigned int length = hashtable_flat_fit(minsize, 0);
+    h->minlength = length;
+    h->table = NULL;
+    h->occupied = NULL;
+    h->primeindex = 0;
+    h->entrycount = 0;
+    return flat_alloc(h, length);
+}
+
+unsigned int hashtable_flat_find(hashtable *h, void *k, unsigned int hashvalue) {
+    unsigned int groupmask = h->length / FLAT_GROUP_WIDTH - 1;
+    unsigned int g = flat_h1(hashvalue) & groupmask;
+    unsigned int step = 0, m, i;
+    signed char tag = flat_h2(hashvalue);
+    const signed char *group;
+    while (1) {
+        group = h->ctrl + g * FLAT_GROUP_WIDTH;
+        for (m = flat_group_match(group, tag); m != 0; m &= m - 1) {
+            i = g * FLAT_GROUP_WIDTH + flat_lowest_bit(m);
+            HASHTABLE_STAT(hashvalue == h->slots[i].hash ? h->stats.eqfncalls++ : h->stats.hashskips++);
+            /* Check hash value to short circuit heavier comparison */
+            if ((hashvalue == h->slots[i].hash) && (h->eqfn(k, h->slots[i].key))) {
+                HASHTABLE_STAT(hashtable_stats_probe(&h->stats, step + 1));
+                return i;
+            }
+        }
+        /* an EMPTY byte means the key was never pushed past this group */
+        if (flat_group_match_empty(group)) {
+            HASHTABLE_STAT(hashtable_stats_probe(&h->stats, step + 1));
+            return h->length;
+        }
+        g = (g + ++step) & groupmask;
+    }
+}
+
+int hashtable_flat_set(hashtable *h, void *k, void *v) {
+    return hashtable_flat_set_hashed(h, k, v, hash(h, k));
+}
+
+int hashtable_flat_set_hashed(hashtable *h, void *k, void *v, unsigned int hashvalue) {
+    unsigned int groupmask = h->length / FLAT_GROUP_WIDTH - 1;
+    unsigned int g = flat_h1(hashvalue) & groupmask;
+    unsigned int step = 0, m, i, newlength;
+    unsigned int target = h->length;
+    signed char tag = flat_h2(hashvalue);
+    const signed char *group;
+    while (1) {
+        group = h->ctrl + g * FLAT_GROUP_WIDTH;
+        for (m = flat_group_match(group, tag); m != 0; m &= m - 1) {
+            i = g * FLAT_GROUP_WIDTH + flat_lowest_bit(m);
+            HASHTABLE_STAT(hashvalue == h->slots[i].hash ? h->stats.eqfncalls++ : h->stats.hashskips++);
+            if ((hashvalue == h->slots[i].hash) && (h->eqfn(k, h->slots[i].key)))
+            {
+                HASHTABLE_STAT(hashtable_stats_probe(&h->stats, step + 1));
+                free(h->slots[i].value);
+                h->slots[i].value = v;
+                return -1;
+            }
+        }
+        /* remember the first reusable slot, but keep probing for the key */
+        if (target == h->length && (m = flat_group_match_free(group)) != 0)
+            target = g * FLAT_GROUP_WIDTH + flat_lowest_bit(m);
+        if (flat_group_match_empty(group))
+            break;
+        g = (g + ++step) & groupmask;
+    }
+    HASHTABLE_STAT(hashtable_stats_probe(&h->stats, step + 1));
+
+    if (h->ctrl[target] == FLAT_EMPTY && h->entrycount + h->tombstones >= h->loadlimit) {
+        /* mostly tombstones: rebuild at the same size, otherwise grow */
+        newlength = h->length;
+        if (h->entrycount >= h->loadlimit / 2) {
+            if (h->length < FLAT_MAX_LENGTH) {
+                newlength = h->length << 1;
+            }
+            else if (h->tombstones == 0) {
+                return 0;
+            }
+        }
+        if (!hashtable_flat_resize(h, newlength)) {
+            return 0;
+        }
+        target = flat_find_free(h->ctrl, h->length, hashvalue);
+    }
+    if (h->ctrl[target] == FLAT_DELETED) {
+        h->tombstones--;
+    }
+    h->ctrl[target] = tag;
+    h->slots[target].key = k;
+    h->slots[target].value = v;
+    h->slots[target].hash = hashvalue;
+    h->entrycount++;
+    return -1;
+}
+
+void* hashtable_flat_get(hashtable *h, void *k) {
+    unsigned int i = hashtable_flat_find(h, k, hash(h, k));
+    return i == h->length ? NULL : h->slots[i].value;
+}
+
+void* hashtable_flat_erase(hashtable *h, unsigned int index) {
+    void *v = h->slots[index].value;
+    /* A group that still has an EMPTY byte stops every probe reaching it,
+     * so no probe sequence can rely on this slot having been full. */
+    if (flat_group_match_empty(h->ctrl + (index & ~(FLAT_GROUP_WIDTH - 1)))) {
+        h->ctrl[index] = FLAT_EMPTY;
+    }
+    else {
+        h->ctrl[index] = FLAT_DELETED;
+        h->tombstones++;
+    }
+    h->entrycount--;
+    free(h->slots[index].key);
+    return v;
+}
+
+void* hashtable_flat_remove(hashtable *h, void *k) {
+    unsigned int i = hashtable_flat_find(h, k, hash(h, k));
+    if (i == h->length) {
+        return NULL;
+    }
+    return hashtable_flat_erase(h, i);
+}
+
+unsigned int hashtable_flat_next(hashtable *h, unsigned int index) {
+    unsigned int g, m;
+    if (index >= h->length) {
+        return h->length;
+    }
+    g = index & ~(FLAT_GROUP_WIDTH - 1);
+    m = flat_group_match_full(h->ctrl + g) & (0xffffu << (index - g));
+    while (m == 0) {
+        g += FLAT_GROUP_WIDTH;
+        if (g >= h->length) {
+            return h->length;
+        }
+        m = flat_group_match_full(h->ctrl + g);
+    }
+    return g + flat_lowest_bit(m);
+}
+
+void hashtable_flat_destroy(hashtable *h, int free_values) {
+    unsigned int i;
+    for (i = 0; i < h->length; i++) {
+        if (h->ctrl[i] >= 0) {
+            free(h->slots[i].key);
+            if (free_values) {
+                free(h->slots[i].value);
+            }
+        }
+    }
+    free(h->ctrl);
+    free(h->slots);
+}
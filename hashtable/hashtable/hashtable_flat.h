@@ -0,0 +1,124 @@
+//
+//  hashtable_flat.h
+//  hashtable
+//
+//  Open addressing backend behind HASHTABLE_FLAT. Slots are kept in one
+//  flat array with a control byte per slot: EMPTY, DELETED, or the low
+//  7 bits of the slot's hash. Probing compares a whole group of 16
+//  control bytes at once, so most misses never touch a slot.
+//
+
+#ifndef hashtable_hashtable_flat_h
+#define hashtable_hashtable_flat_h
+
+#include "hashtable.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FLAT_GROUP_WIDTH    16
+#define FLAT_EMPTY          ((signed char)-128)
+#define FLAT_DELETED        ((signed char)-2)
+
+/* h1 selects the first group to probe, h2 is the tag kept in the control byte */
+static inline unsigned int flat_h1(unsigned int hashvalue) {
+    return hashvalue >> 7;
+}
+
+static inline signed char flat_h2(unsigned int hashvalue) {
+    return (signed char)(hashvalue & 0x7f);
+}
+
+/* bit i is set when control byte i of the group equals 'tag' */
+static inline unsigned int flat_group_match(const signed char *group, signed char tag) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), ctrl));
+#else
+    unsigned int i, mask = 0;
+    for (i = 0; i < FLAT_GROUP_WIDTH; i++) {
+        if (group[i] == tag) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline unsigned int flat_group_match_empty(const signed char *group) {
+    return flat_group_match(group, FLAT_EMPTY);
+}
+
+/* EMPTY and DELETED are the only control bytes below -1 */
+static inline unsigned int flat_group_match_free(const signed char *group) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl));
+#else
+    unsigned int i, mask = 0;
+    for (i = 0; i < FLAT_GROUP_WIDTH; i++) {
+        if (group[i] < -1) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+/* full slots carry a tag in 0..127, i.e. the sign bit is clear */
+static inline unsigned int flat_group_match_full(const signed char *group) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return ~(unsigned int)_mm_movemask_epi8(ctrl) & 0xffffu;
+#else
+    unsigned int i, mask = 0;
+    for (i = 0; i < FLAT_GROUP_WIDTH; i++) {
+        if (group[i] >= 0) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline unsigned int flat_lowest_bit(unsigned int mask) {
+    return (unsigned int)__builtin_ctz(mask);
+}
+
+/* pulls in the control group probed first for 'hashvalue' */
+static inline void flat_prefetch_group(hashtable *h, unsigned int hashvalue) {
+    unsigned int g = flat_h1(hashvalue) & (h->length / FLAT_GROUP_WIDTH - 1);
+    __builtin_prefetch(h->ctrl + g * FLAT_GROUP_WIDTH);
+}
+
+/* pulls in the slot of the first tag match in that group, if any */
+static inline void flat_prefetch_slot(hashtable *h, unsigned int hashvalue) {
+    unsigned int g = flat_h1(hashvalue) & (h->length / FLAT_GROUP_WIDTH - 1);
+    unsigned int m = flat_group_match(h->ctrl + g * FLAT_GROUP_WIDTH, flat_h2(hashvalue));
+    if (m != 0)
+        __builtin_prefetch(&h->slots[g * FLAT_GROUP_WIDTH + flat_lowest_bit(m)]);
+}
+
+int hashtable_flat_init(hashtable *h, unsigned int minsize);
+
+int hashtable_flat_set(hashtable *h, void *k, void *v);
+
+int hashtable_flat_set_hashed(hashtable *h, void *k, void *v, unsigned int hashvalue);
+
+void* hashtable_flat_get(hashtable *h, void *k);
+
+void* hashtable_flat_remove(hashtable *h, void *k);
+
+void hashtable_flat_destroy(hashtable *h, int free_values);
+
+/* smallest slot count not below 'floor' that holds 'count' entries */
+unsigned int hashtable_flat_fit(unsigned int count, unsigned int floor);
+
+/* rehashes into 'newlength' slots, dropping all tombstones */
+int hashtable_flat_resize(hashtable *h, unsigned int newlength);
+
+/* slot index holding 'k', or h->length when absent */
+unsigned int hashtable_flat_find(hashtable *h, void *k, unsigned int hashvalue);
+
+/* index of the first full slot at or after 'index', or h->length */
+unsigned int hashtable_flat_next(hashtable *h, unsigned int index);
+
+/* empties a full slot, frees its key and returns its value */
+void* hashtable_flat_erase(hashtable *h, unsigned int index);
+
+#endif
@@ -43,38 +43,56 @@
 
 #include <stdlib.h>
 #include "hashtable_iterator.h"
+#include "hashtable_flat.h"
 
 hashtable_iterator *hashtable_iterator_create(hashtable *h) {
-    unsigned int i, tablelength;
+    return hashtable_iterator_create_range(h, 0, 1);
+}
+
+hashtable_iterator *hashtable_iterator_create_range(hashtable *h, unsigned int part, unsigned int parts) {
+    unsigned int i, start;
     hashtable_iterator *itr = (hashtable_iterator *)malloc(sizeof(hashtable_iterator));
     if (itr == NULL) 
         return NULL;
+    /* iterate a single table: land any pending incremental expansion */
+    while (hashtable_rehash_step(h, h->oldlength)) ;
     itr->h = h;
     itr->e = NULL;
     itr->parent = NULL;
-    tablelength = h->length;
-    itr->index = tablelength;
+    start = (unsigned int)((unsigned long long)h->length * part / parts);
+    itr->end = (unsigned int)((unsigned long long)h->length * (part + 1) / parts);
+    itr->index = itr->end;
     if (h->entrycount == 0) 
         return itr;
+    if (h->flags & HASHTABLE_FLAT) {
+        i = hashtable_flat_next(h, start);
+        itr->index = i < itr->end ? i : itr->end;
+        return itr;
+    }
     
-    for (i = 0; i < tablelength; i++)
+    i = hashtable_next_occupied(h, start, itr->end);
+    if (i < itr->end)
     {
-        if (h->table[i] != NULL)
-        {
-            itr->e = h->table[i];
-            itr->index = i;
-            break;
-        }
+        itr->e = h->table[i];
+        itr->index = i;
     }
     return itr;
 }
 
 int hashtable_iterator_advance(hashtable_iterator *itr) {
+    if (itr->h->flags & HASHTABLE_FLAT) {
+        if (itr->index >= itr->end)
+            return 0;
+        itr->index = hashtable_flat_next(itr->h, itr->index + 1);
+        if (itr->index < itr->end)
+            return -1;
+        itr->index = itr->end;
+        return 0;
+    }
     if (itr->e == NULL) 
         return 0;
     
     unsigned int j,tablelength;
-    struct entry **table;
     struct entry *next;
     
     next = itr->e->next;
@@ -84,25 +102,23 @@ int hashtable_iterator_advance(hashtable_iterator *itr) {
         itr->e = next;
         return -1;
     }
-    tablelength = itr->h->length;
+    tablelength = itr->end;
     itr->parent = NULL;
     if (tablelength <= (j = ++(itr->index)))
     {
         itr->e = NULL;
         return 0;
     }
-    table = itr->h->table;
-    while ((next = table[j]) == NULL)
+    /* jump straight to the next non-empty bucket */
+    j = hashtable_next_occupied(itr->h, j, tablelength);
+    if (j >= tablelength)
     {
-        if (++j >= tablelength)
-        {
-            itr->index = tablelength;
-            itr->e = NULL;
-            return 0;
-        }
+        itr->index = tablelength;
+        itr->e = NULL;
+        return 0;
     }
     itr->index = j;
-    itr->e = next;
+    itr->e = itr->h->table[j];
     return -1;
 }
 
@@ -110,9 +126,15 @@ int hashtable_iterator_remove(hashtable_iterator *itr) {
     entry *remember_e, *remember_parent;
     int ret;
     
+    if (itr->h->flags & HASHTABLE_FLAT) {
+        hashtable_flat_erase(itr->h, itr->index);
+        return hashtable_iterator_advance(itr);
+    }
     if ((itr->parent) == NULL)
     {
         itr->h->table[itr->index] = itr->e->next;
+        if (itr->e->next == NULL)
+            hashtable_unmark(itr->h->occupied, itr->index);
     } else {
         itr->parent->next = itr->e->next;
     }
@@ -127,7 +149,7 @@ int hashtable_iterator_remove(hashtable_iterator *itr) {
     if (itr->parent == remember_e) { 
         itr->parent = remember_parent; 
     }
-    free(remember_e);
+    itr->h->allocator.free(itr->h->allocator.ctx, remember_e, sizeof(entry));
     return ret;
 }
 
@@ -135,7 +157,19 @@ int hashtable_iterator_search(hashtable_iterator *itr, hashtable *h, void *k) {
     entry *e, *parent;
     unsigned int hashvalue, index;
     
+    while (hashtable_rehash_step(h, h->oldlength)) ;
     hashvalue = hash(h, k);
+    if (h->flags & HASHTABLE_FLAT) {
+        index = hashtable_flat_find(h, k, hashvalue);
+        if (index == h->length)
+            return 0;
+        itr->index = index;
+        itr->end = h->length;
+        itr->e = NULL;
+        itr->parent = NULL;
+        itr->h = h;
+        return -1;
+    }
     index = indexFor(h->length, hashvalue);
     e = h->table[index];
     parent = NULL;
@@ -144,6 +178,7 @@ int hashtable_iterator_search(hashtable_iterator *itr, hashtable *h, void *k) {
         if ((hashvalue == e->hash) && (h->eqfn(k, e->key)))
         {
             itr->index = index;
+            itr->end = h->length;
             itr->e = e;
             itr->parent = parent;
             itr->h = h;
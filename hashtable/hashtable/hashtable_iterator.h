@@ -51,15 +51,31 @@ typedef struct{
     entry *e;
     entry *parent;
     unsigned int index;
+    unsigned int end;               /* one past the last bucket or slot visited */
 } hashtable_iterator;
 
 hashtable_iterator *hashtable_iterator_create(hashtable *h);
 
-extern inline void *hashtable_iterator_key(hashtable_iterator *i) {
+/* Visits only buckets [part * length / parts, (part + 1) * length / parts),
+ * so 'parts' iterators over the same unchanged table cover it exactly once
+ * and can run on different threads. The range may hold no entry at all;
+ * check hashtable_iterator_valid before the first key/value. */
+hashtable_iterator *hashtable_iterator_create_range(hashtable *h, unsigned int part, unsigned int parts);
+
+static inline int hashtable_iterator_valid(hashtable_iterator *i) {
+    return i->index < i->end;
+}
+
+/* HASHTABLE_FLAT iterators leave 'e' unused and walk slot 'index' */
+static inline void *hashtable_iterator_key(hashtable_iterator *i) {
+    if (i->h->flags & HASHTABLE_FLAT)
+        return i->h->slots[i->index].key;
     return i->e->key;
 }
 
-extern inline void *hashtable_iterator_value(hashtable_iterator *i) {
+static inline void *hashtable_iterator_value(hashtable_iterator *i) {
+    if (i->h->flags & HASHTABLE_FLAT)
+        return i->h->slots[i->index].value;
     return i->e->value;
 }
 
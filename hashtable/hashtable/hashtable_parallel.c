@@ -0,0 +1,246 @@
+//
+//  hashtable_parallel.c
+//  hashtable
+//
+//  Multi-threaded bulk load and scan, see hashtable_parallel.h.
+//
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "hashtable_parallel.h"
+#include "hashtable_iterator.h"
+
+/* below this many pairs per thread the thread start-up is not worth it */
+#define PARALLEL_MIN_PER_THREAD 4096
+
+typedef struct {
+    hashtable *h;
+    void **keys;
+    void **values;
+    unsigned int *hashes;
+    unsigned int *order;
+    unsigned int *counts;           /* per partition: sizes, then write cursors */
+    unsigned int parts;
+    unsigned int begin;             /* input slice, or 'order' range when linking */
+    unsigned int end;
+    unsigned int stored;
+    unsigned int added;
+    pthread_mutex_t *alloclock;     /* NULL when the allocator is thread safe */
+} load_task;
+
+typedef struct {
+    hashtable_iterator *itr;
+    void (*fn)(void *ctx, void *k, void *v, unsigned int part);
+    void *ctx;
+    unsigned int part;
+} scan_task;
+
+/* runs fn over every task, one thread each; a thread that cannot be
+ * started has its task run on the calling thread instead */
+static void parallel_run(void *(*fn)(void *), void *tasks, size_t tasksize, unsigned int count) {
+    pthread_t threads[HASHTABLE_MAX_THREADS];
+    int started[HASHTABLE_MAX_THREADS];
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, fn, (char *)tasks + i * tasksize) == 0;
+        if (!started[i]) {
+            fn((char *)tasks + i * tasksize);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+static unsigned int parallel_partition(hashtable *h, unsigned int hashvalue, unsigned int parts) {
+    return (unsigned int)((unsigned long long)indexFor(h->length, hashvalue) * parts / h->length);
+}
+
+/* phase 1: hash the slice and count how much of it lands in each range */
+static void *parallel_hash(void *arg) {
+    load_task *t = (load_task *)arg;
+    unsigned int i;
+    for (i = t->begin; i < t->end; i++) {
+        t->hashes[i] = hash(t->h, t->keys[i]);
+        t->counts[parallel_partition(t->h, t->hashes[i], t->parts)]++;
+    }
+    return NULL;
+}
+
+/* phase 2: scatter the slice's input positions to their ranges */
+static void *parallel_scatter(void *arg) {
+    load_task *t = (load_task *)arg;
+    unsigned int i;
+    for (i = t->begin; i < t->end; i++) {
+        t->order[t->counts[parallel_partition(t->h, t->hashes[i], t->parts)]++] = i;
+    }
+    return NULL;
+}
+
+/* phase 3: link every pair of one range; no other thread sees its buckets */
+static void *parallel_link(void *arg) {
+    load_task *t = (load_task *)arg;
+    hashtable *h = t->h;
+    struct entry *e;
+    unsigned int j, i, index;
+    for (j = t->begin; j < t->end; j++) {
+        i = t->order[j];
+        index = indexFor(h->length, t->hashes[i]);
+        for (e = h->table[index]; e != NULL; e = e->next) {
+            /* Check hash value to short circuit heavier comparison */
+            if ((t->hashes[i] == e->hash) && (h->eqfn(t->keys[i], e->key)))
+                break;
+        }
+        if (e != NULL) {
+            free(e->value);
+            e->value = t->values[i];
+            t->stored++;
+            continue;
+        }
+        if (t->alloclock != NULL) {
+            pthread_mutex_lock(t->alloclock);
+            e = (struct entry *)h->allocator.alloc(h->allocator.ctx, sizeof(struct entry));
+            pthread_mutex_unlock(t->alloclock);
+        }
+        else {
+            e = (struct entry *)h->allocator.alloc(h->allocator.ctx, sizeof(struct entry));
+        }
+        if (e == NULL) {
+            continue;
+        }
+        e->hash = t->hashes[i];
+        e->key = t->keys[i];
+        e->value = t->values[i];
+        e->next = h->table[index];
+        h->table[index] = e;
+        /* neighbouring ranges can share a bitmap word */
+        __atomic_fetch_or(&h->occupied[index >> 6], 1ull << (index & 63), __ATOMIC_RELAXED);
+        t->stored++;
+        t->added++;
+    }
+    return NULL;
+}
+
+unsigned int hashtable_load_parallel(hashtable *h, void **keys, void **values, unsigned int n, unsigned int threads) {
+    load_task tasks[HASHTABLE_MAX_THREADS];
+    unsigned int *counts, *hashes, *order;
+    unsigned int t, p, offset, stored = 0;
+    pthread_mutex_t alloclock;
+
+    if (threads > HASHTABLE_MAX_THREADS) {
+        threads = HASHTABLE_MAX_THREADS;
+    }
+    if (h->entrycount + n >= h->entrycount) {
+        hashtable_reserve(h, h->entrycount + n);
+    }
+    if ((h->flags & HASHTABLE_FLAT) || threads < 2 || n < threads * PARALLEL_MIN_PER_THREAD) {
+        return hashtable_set_many(h, keys, values, n);
+    }
+    hashes = (unsigned int *)malloc(sizeof(unsigned int) * n);
+    order = (unsigned int *)malloc(sizeof(unsigned int) * n);
+    counts = (unsigned int *)calloc(threads * threads, sizeof(unsigned int));
+    if (hashes == NULL || order == NULL || counts == NULL) {
+        free(hashes);
+        free(order);
+        free(counts);
+        return hashtable_set_many(h, keys, values, n);
+    }
+    pthread_mutex_init(&alloclock, NULL);
+
+    for (t = 0; t < threads; t++) {
+        tasks[t].h = h;
+        tasks[t].keys = keys;
+        tasks[t].values = values;
+        tasks[t].hashes = hashes;
+        tasks[t].order = order;
+        tasks[t].counts = counts + t * threads;
+        tasks[t].parts = threads;
+        tasks[t].begin = (unsigned int)((unsigned long long)n * t / threads);
+        tasks[t].end = (unsigned int)((unsigned long long)n * (t + 1) / threads);
+        tasks[t].stored = 0;
+        tasks[t].added = 0;
+        tasks[t].alloclock = h->allocator.ctx != NULL ? &alloclock : NULL;
+    }
+    parallel_run(parallel_hash, tasks, sizeof(load_task), threads);
+
+    /* range p of slice t starts after all of ranges < p, then slices < t */
+    offset = 0;
+    for (p = 0; p < threads; p++) {
+        for (t = 0; t < threads; t++) {
+            unsigned int size = counts[t * threads + p];
+            counts[t * threads + p] = offset;
+            offset += size;
+        }
+    }
+    parallel_run(parallel_scatter, tasks, sizeof(load_task), threads);
+
+    /* after scattering, slice threads-1's cursor for range p ends range p */
+    for (p = 0; p < threads; p++) {
+        tasks[p].begin = p == 0 ? 0 : counts[(threads - 1) * threads + p - 1];
+        tasks[p].end = counts[(threads - 1) * threads + p];
+    }
+    parallel_run(parallel_link, tasks, sizeof(load_task), threads);
+
+    for (t = 0; t < threads; t++) {
+        stored += tasks[t].stored;
+        h->entrycount += tasks[t].added;
+    }
+    pthread_mutex_destroy(&alloclock);
+    free(hashes);
+    free(order);
+    free(counts);
+    return stored;
+}
+
+static void *parallel_scan(void *arg) {
+    scan_task *t = (scan_task *)arg;
+    if (!hashtable_iterator_valid(t->itr))
+        return NULL;
+    do {
+        t->fn(t->ctx, hashtable_iterator_key(t->itr), hashtable_iterator_value(t->itr), t->part);
+    } while (hashtable_iterator_advance(t->itr));
+    return NULL;
+}
+
+void hashtable_foreach_parallel(hashtable *h, unsigned int threads, void (*fn)(void *ctx, void *k, void *v, unsigned int part), void *ctx) {
+    scan_task tasks[HASHTABLE_MAX_THREADS];
+    unsigned int t, made;
+    if (threads > HASHTABLE_MAX_THREADS) {
+        threads = HASHTABLE_MAX_THREADS;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    /* the iterators land any migration, so create them before any thread runs */
+    for (made = 0; made < threads; made++) {
+        tasks[made].itr = hashtable_iterator_create_range(h, made, threads);
+        if (tasks[made].itr == NULL) {
+            break;
+        }
+        tasks[made].fn = fn;
+        tasks[made].ctx = ctx;
+        tasks[made].part = made;
+    }
+    if (made == threads) {
+        parallel_run(parallel_scan, tasks, sizeof(scan_task), threads);
+    }
+    else {
+        /* out of memory: fall back to one iterator on this thread */
+        for (t = 0; t < made; t++) {
+            free(tasks[t].itr);
+        }
+        if ((tasks[0].itr = hashtable_iterator_create(h)) != NULL) {
+            tasks[0].fn = fn;
+            tasks[0].ctx = ctx;
+            tasks[0].part = 0;
+            parallel_scan(&tasks[0]);
+            free(tasks[0].itr);
+        }
+        return;
+    }
+    for (t = 0; t < threads; t++) {
+        free(tasks[t].itr);
+    }
+}
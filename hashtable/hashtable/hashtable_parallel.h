@@ -0,0 +1,30 @@
+//
+//  hashtable_parallel.h
+//  hashtable
+//
+//  Multi-threaded bulk load and scan of a plain hashtable. Both split the
+//  bucket array into contiguous ranges, one per thread, so no two threads
+//  ever touch the same chain and no locks are taken on the table.
+//
+
+#ifndef hashtable_hashtable_parallel_h
+#define hashtable_hashtable_parallel_h
+
+#include "hashtable.h"
+
+#define HASHTABLE_MAX_THREADS   64
+
+/* Inserts n pairs like hashtable_set_many, using up to 'threads' threads.
+ * The table is grown once up front, the input is hashed and partitioned
+ * by bucket range in parallel, and each thread then links its own range.
+ * The table must not be used by anyone else meanwhile. HASHTABLE_FLAT
+ * tables probe across ranges and are filled on the calling thread.
+ * Allocators with a non-NULL ctx (the slab, for one) are called under a
+ * lock. Returns how many pairs were stored. */
+unsigned int hashtable_load_parallel(hashtable *h, void **keys, void **values, unsigned int n, unsigned int threads);
+
+/* Calls fn(ctx, key, value, part) for every entry, part 'part' of 'threads'
+ * range iterators running on its own thread. fn must not modify the table. */
+void hashtable_foreach_parallel(hashtable *h, unsigned int threads, void (*fn)(void *ctx, void *k, void *v, unsigned int part), void *ctx);
+
+#endif
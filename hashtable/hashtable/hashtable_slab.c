@@ -0,0 +1,76 @@
+//
+//  hashtable_slab.c
+//  hashtable
+//
+//  Fixed-size object arena behind HASHTABLE_SLAB, see hashtable_slab.h.
+//
+
+#include <stdlib.h>
+#include "hashtable_slab.h"
+
+#define SLAB_FIRST_BLOCK    64
+#define SLAB_MAX_BLOCK      65536
+
+hashtable_slab* hashtable_slab_create(size_t objsize) {
+    hashtable_slab *slab = (hashtable_slab *)malloc(sizeof(hashtable_slab));
+    if (slab == NULL) {
+        return NULL;
+    }
+    // room for the free list link, and keep pointers aligned
+    if (objsize < sizeof(void *)) {
+        objsize = sizeof(void *);
+    }
+    slab->objsize = (objsize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    slab->perblock = SLAB_FIRST_BLOCK;
+    slab->blocks = NULL;
+    slab->cursor = NULL;
+    slab->limit = NULL;
+    slab->freelist = NULL;
+    return slab;
+}
+
+void* hashtable_slab_alloc(void *ctx, size_t size) {
+    hashtable_slab *slab = (hashtable_slab *)ctx;
+    slab_block *block;
+    void *p;
+    if (size > slab->objsize) {
+        return NULL;
+    }
+    if ((p = slab->freelist) != NULL) {
+        slab->freelist = *(void **)p;
+        return p;
+    }
+    if (slab->cursor == slab->limit) {
+        /* header padded to objsize keeps objects aligned like the first one */
+        block = (slab_block *)malloc(slab->objsize * (slab->perblock + 1));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = slab->blocks;
+        slab->blocks = block;
+        slab->cursor = (char *)block + slab->objsize;
+        slab->limit = slab->cursor + slab->objsize * slab->perblock;
+        if (slab->perblock < SLAB_MAX_BLOCK) {
+            slab->perblock <<= 1;
+        }
+    }
+    p = slab->cursor;
+    slab->cursor += slab->objsize;
+    return p;
+}
+
+void hashtable_slab_free(void *ctx, void *p, size_t size) {
+    hashtable_slab *slab = (hashtable_slab *)ctx;
+    *(void **)p = slab->freelist;
+    slab->freelist = p;
+}
+
+void hashtable_slab_release(void *ctx) {
+    hashtable_slab *slab = (hashtable_slab *)ctx;
+    slab_block *block, *next;
+    for (block = slab->blocks; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(slab);
+}
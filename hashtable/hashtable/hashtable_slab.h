@@ -0,0 +1,37 @@
+//
+//  hashtable_slab.h
+//  hashtable
+//
+//  Fixed-size object arena behind HASHTABLE_SLAB. Objects are carved from
+//  large blocks, freed objects go on a free list for reuse, and the whole
+//  arena is handed back to the system block by block in one go.
+//
+
+#ifndef hashtable_hashtable_slab_h
+#define hashtable_hashtable_slab_h
+
+#include <stddef.h>
+
+typedef struct slab_block {
+    struct slab_block *next;
+} slab_block;
+
+typedef struct {
+    size_t objsize;
+    size_t perblock;            /* objects in the next block, doubles up to a cap */
+    slab_block *blocks;
+    char *cursor;               /* next never used object in the newest block */
+    char *limit;
+    void *freelist;             /* freed objects, linked through their first word */
+} hashtable_slab;
+
+hashtable_slab* hashtable_slab_create(size_t objsize);
+
+/* signatures match hashtable_allocator, 'slab' is its ctx */
+void* hashtable_slab_alloc(void *slab, size_t size);
+
+void hashtable_slab_free(void *slab, void *p, size_t size);
+
+void hashtable_slab_release(void *slab);
+
+#endif
@@ -0,0 +1,229 @@
+//
+//  hashtable_snapshot.c
+//  hashtable
+//
+//  mmap-able hashtable images, see hashtable_snapshot.h.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hashtable_snapshot.h"
+#include "hashtable_iterator.h"
+
+static uint64_t snapshot_align(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+static uint64_t snapshot_record_size(uint64_t keylen, uint64_t valuelen) {
+    return sizeof(snapshot_record) + snapshot_align(keylen) + snapshot_align(valuelen);
+}
+
+int hashtable_snapshot_save(hashtable *h, const char *path, size_t (*key_size)(void *k), size_t (*value_size)(void *v)) {
+    uint64_t bucketcount = 1, filesize, offset, i;
+    uint64_t *cursors = NULL;
+    uint64_t *buckets;
+    snapshot_header *header;
+    snapshot_record *record;
+    hashtable_iterator *itr = NULL;
+    unsigned int hashvalue;
+    size_t keylen, valuelen;
+    void *k, *v, *map = MAP_FAILED;
+    char *base, *tmppath;
+    int fd = -1, ok = 0;
+
+    /* load factor at most one keeps the bucket array as large as the count */
+    while (bucketcount < h->entrycount) {
+        bucketcount <<= 1;
+    }
+    /* written next to 'path' and renamed over it once complete, so a
+     * reader that has the old image mapped keeps it intact and a crash
+     * halfway leaves the old image in place */
+    tmppath = (char *)malloc(strlen(path) + sizeof(".tmp"));
+    cursors = (uint64_t *)calloc(bucketcount, sizeof(uint64_t));
+    itr = hashtable_iterator_create(h);
+    if (tmppath == NULL || cursors == NULL || itr == NULL) {
+        goto out;
+    }
+    strcpy(tmppath, path);
+    strcat(tmppath, ".tmp");
+
+    /* pass 1: bytes per bucket, turned into record offsets */
+    if (h->entrycount > 0) {
+        do {
+            k = hashtable_iterator_key(itr);
+            v = hashtable_iterator_value(itr);
+            keylen = key_size(k);
+            valuelen = value_size != NULL ? value_size(v) : 0;
+            if ((uint64_t)keylen > UINT32_MAX || (uint64_t)valuelen > UINT32_MAX) {
+                goto out; // records store 32 bit lengths
+            }
+            cursors[hash(h, k) & (bucketcount - 1)] += snapshot_record_size(keylen, valuelen);
+        } while (hashtable_iterator_advance(itr));
+    }
+    offset = sizeof(snapshot_header) + (bucketcount + 1) * sizeof(uint64_t);
+    for (i = 0; i < bucketcount; i++) {
+        uint64_t bytes = cursors[i];
+        cursors[i] = offset;
+        offset += bytes;
+    }
+    filesize = offset;
+
+    fd = open(tmppath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        goto out;
+    }
+    if (ftruncate(fd, (off_t)filesize) == 0) {
+        map = mmap(NULL, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        goto out;
+    }
+    base = (char *)map;
+    header = (snapshot_header *)base;
+    buckets = (uint64_t *)(base + sizeof(snapshot_header));
+    memcpy(buckets, cursors, bucketcount * sizeof(uint64_t));
+    buckets[bucketcount] = filesize;
+
+    /* pass 2: every record goes to its bucket's cursor */
+    free(itr);
+    itr = hashtable_iterator_create(h);
+    if (itr == NULL) {
+        goto out;
+    }
+    if (h->entrycount > 0) {
+        do {
+            k = hashtable_iterator_key(itr);
+            v = hashtable_iterator_value(itr);
+            hashvalue = hash(h, k);
+            keylen = key_size(k);
+            valuelen = value_size != NULL ? value_size(v) : 0;
+            i = hashvalue & (bucketcount - 1);
+            record = (snapshot_record *)(base + cursors[i]);
+            record->hash = hashvalue;
+            record->keylen = (uint32_t)keylen;
+            record->valuelen = (uint32_t)valuelen;
+            record->reserved = 0;
+            memcpy((char *)(record + 1), k, keylen);
+            if (valuelen > 0) {
+                memcpy((char *)(record + 1) + snapshot_align(keylen), v, valuelen);
+            }
+            cursors[i] += snapshot_record_size(keylen, valuelen);
+        } while (hashtable_iterator_advance(itr));
+    }
+
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->byteorder = SNAPSHOT_BYTEORDER;
+    header->count = h->entrycount;
+    header->bucketcount = bucketcount;
+    header->filesize = filesize;
+    /* on disk before the rename makes it visible */
+    ok = msync(map, filesize, MS_SYNC) == 0 && fsync(fd) == 0;
+
+out:
+    if (map != MAP_FAILED) {
+        munmap(map, filesize);
+    }
+    if (fd >= 0) {
+        close(fd);
+        if (ok) {
+            ok = rename(tmppath, path) == 0;
+        }
+        if (!ok) {
+            unlink(tmppath);
+        }
+    }
+    free(tmppath);
+    free(itr);
+    free(cursors);
+    return ok ? -1 : 0;
+}
+
+hashtable_snapshot* hashtable_snapshot_open(const char *path, unsigned int (*hashfunction)(void*), int (*key_eq_fn)(void*, void*)) {
+    hashtable_snapshot *s;
+    const snapshot_header *header;
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    header = (const snapshot_header *)map;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->byteorder != SNAPSHOT_BYTEORDER ||
+        header->filesize != (uint64_t)st.st_size ||
+        header->bucketcount == 0 ||
+        (header->bucketcount & (header->bucketcount - 1)) != 0 ||
+        /* the offset table must fit; the offsets in it are checked per lookup */
+        header->bucketcount >= (header->filesize - sizeof(snapshot_header)) / sizeof(uint64_t)) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    s = (hashtable_snapshot *)malloc(sizeof(hashtable_snapshot));
+    if (s == NULL) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    /* lookups jump around; readahead would only drag in unrelated pages */
+    madvise(map, (size_t)st.st_size, MADV_RANDOM);
+    s->map = map;
+    s->mapsize = (size_t)st.st_size;
+    s->header = header;
+    s->buckets = (const uint64_t *)((const char *)map + sizeof(snapshot_header));
+    s->hashfn = hashfunction;
+    s->eqfn = key_eq_fn;
+    return s;
+}
+
+/* Offsets and lengths come from the file, so every record is checked to
+ * lie inside its bucket, and the bucket inside the records area, before
+ * it is touched; a corrupt image makes lookups miss, never overrun. */
+const void* hashtable_snapshot_get(hashtable_snapshot *s, void *k) {
+    unsigned int hashvalue = hash_mix(s->hashfn(k));
+    uint64_t index = hashvalue & (s->header->bucketcount - 1);
+    uint64_t offset = s->buckets[index];
+    uint64_t end = s->buckets[index + 1];
+    uint64_t start = sizeof(snapshot_header) + (s->header->bucketcount + 1) * sizeof(uint64_t);
+    uint64_t size;
+    const char *base = (const char *)s->map;
+    const snapshot_record *record;
+    if (offset < start || offset > end || end > s->mapsize || (offset & 7) != 0) {
+        return NULL;
+    }
+    while (end - offset >= sizeof(snapshot_record)) {
+        record = (const snapshot_record *)(base + offset);
+        size = snapshot_record_size(record->keylen, record->valuelen);
+        if (size > end - offset) {
+            return NULL;
+        }
+        /* Check hash value to short circuit heavier comparison */
+        if (record->hash == hashvalue && s->eqfn(k, (void *)(record + 1)))
+            return (const char *)(record + 1) + snapshot_align(record->keylen);
+        offset += size;
+    }
+    return NULL;
+}
+
+unsigned int hashtable_snapshot_count(hashtable_snapshot *s) {
+    return (unsigned int)s->header->count;
+}
+
+void hashtable_snapshot_close(hashtable_snapshot *s) {
+    munmap(s->map, s->mapsize);
+    free(s);
+}
@@ -0,0 +1,76 @@
+//
+//  hashtable_snapshot.h
+//  hashtable
+//
+//  Flat, position independent image of a hashtable that is opened
+//  read-only with mmap and queried in place, so a restart costs page
+//  faults instead of rebuilding the table with hashtable_set.
+//
+//  Layout (native byte order, everything 8-byte aligned):
+//      snapshot_header
+//      uint64_t buckets[bucketcount + 1]   record offsets, bucket i spans
+//                                          [buckets[i], buckets[i + 1])
+//      records                             snapshot_record, key bytes,
+//                                          value bytes, each padded to 8
+//
+//  Keys and values are copied byte for byte, so they must not contain
+//  pointers, and the key bytes must cover everything the table's hashfn
+//  and eqfn look at (the terminating NUL of a string key, say).
+//
+
+#ifndef hashtable_hashtable_snapshot_h
+#define hashtable_hashtable_snapshot_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hashtable.h"
+
+#define SNAPSHOT_MAGIC      "HTSNAP1"
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_BYTEORDER  0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;             /* SNAPSHOT_BYTEORDER as written */
+    uint64_t count;
+    uint64_t bucketcount;           /* power of two */
+    uint64_t filesize;
+} snapshot_header;
+
+typedef struct {
+    uint32_t hash;                  /* hash_mix(hashfn(key)) */
+    uint32_t keylen;
+    uint32_t valuelen;
+    uint32_t reserved;
+} snapshot_record;
+
+typedef struct {
+    void *map;
+    size_t mapsize;
+    const snapshot_header *header;
+    const uint64_t *buckets;
+    unsigned int (*hashfn)(void *k);
+    int (*eqfn)(void *k1, void *k2);
+} hashtable_snapshot;
+
+/* Writes every entry of 'h' to 'path'. key_size/value_size return the
+ * byte length of a key/value, below 4 GiB; value_size may be NULL when all
+ * values are NULL. The image is built in 'path'.tmp and renamed over
+ * 'path', so an existing snapshot stays whole until the new one is on
+ * disk. Returns -1 on success, 0 on failure. */
+int hashtable_snapshot_save(hashtable *h, const char *path, size_t (*key_size)(void *k), size_t (*value_size)(void *v));
+
+/* hashfn/eqfn must be the ones the saved table was created with. Only
+ * the header is checked here; offsets and lengths are checked as lookups
+ * reach them, so opening stays O(1). */
+hashtable_snapshot* hashtable_snapshot_open(const char *path, unsigned int (*hashfunction)(void*), int (*key_eq_fn)(void*, void*));
+
+/* pointer to the value bytes inside the mapping, or NULL when absent */
+const void* hashtable_snapshot_get(hashtable_snapshot *s, void *k);
+
+unsigned int hashtable_snapshot_count(hashtable_snapshot *s);
+
+void hashtable_snapshot_close(hashtable_snapshot *s);
+
+#endif
@@ -0,0 +1,130 @@
+//
+//  hashtable_stats.c
+//  hashtable
+//
+//  Telemetry for hashtables, see hashtable_stats.h.
+//
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include "hashtable_stats.h"
+#include "hashtable_flat.h"
+
+#ifdef HASHTABLE_STATS
+#define STATS_HISTOGRAM     HASHTABLE_STATS_PROBES
+#else
+#define STATS_HISTOGRAM     16
+#endif
+
+#ifdef HASHTABLE_STATS
+unsigned long long hashtable_stats_clock(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000000ull + (unsigned long long)tv.tv_usec * 1000ull;
+#endif
+}
+
+void hashtable_stats_resized(hashtable *h, unsigned long long start) {
+    unsigned long long ns = hashtable_stats_clock() - start;
+    h->stats.resizes++;
+    h->stats.resizens += ns;
+    if (ns > h->stats.resizemaxns)
+        h->stats.resizemaxns = ns;
+}
+#endif
+
+void hashtable_stats_reset(hashtable *h) {
+    HASHTABLE_STAT(memset(&h->stats, 0, sizeof(h->stats)));
+}
+
+static void stats_histogram(FILE *out, const char *name, const char *metric, const unsigned long long *counts) {
+    unsigned int i;
+    for (i = 0; i < STATS_HISTOGRAM - 1; i++) {
+        fprintf(out, "%s.%s.%u %llu\n", name, metric, i, counts[i]);
+    }
+    fprintf(out, "%s.%s.%u+ %llu\n", name, metric, i, counts[i]);
+}
+
+/* bucket lengths of a chained table, both tables while migrating */
+static void stats_chains(hashtable *h, struct entry **table, unsigned int length, unsigned long long *counts, unsigned int *empty, unsigned int *longest) {
+    struct entry *e;
+    unsigned int i, n;
+    for (i = 0; i < length; i++) {
+        /* buckets below 'rehashindex' have moved and are always empty */
+        if (table == h->oldtable && i < h->rehashindex)
+            continue;
+        for (n = 0, e = table[i]; e != NULL; e = e->next) {
+            n++;
+        }
+        counts[n < STATS_HISTOGRAM ? n : STATS_HISTOGRAM - 1]++;
+        if (n == 0)
+            (*empty)++;
+        if (n > *longest)
+            *longest = n;
+    }
+}
+
+/* probe steps between each entry's home group and the group it sits in */
+static void stats_displacement(hashtable *h, unsigned long long *counts, unsigned int *longest) {
+    unsigned int groupmask = h->length / FLAT_GROUP_WIDTH - 1;
+    unsigned int i, g, step;
+    for (i = 0; i < h->length; i++) {
+        if (h->ctrl[i] < 0)
+            continue;
+        g = flat_h1(h->slots[i].hash) & groupmask;
+        for (step = 0; g != i / FLAT_GROUP_WIDTH && step <= groupmask; ) {
+            g = (g + ++step) & groupmask;
+        }
+        counts[step < STATS_HISTOGRAM ? step : STATS_HISTOGRAM - 1]++;
+        if (step > *longest)
+            *longest = step;
+    }
+}
+
+void hashtable_stats_dump(hashtable *h, const char *name, FILE *out) {
+    unsigned long long counts[STATS_HISTOGRAM];
+    unsigned int buckets = h->length + (h->oldtable != NULL ? h->oldlength - h->rehashindex : 0);
+    unsigned int empty = 0, longest = 0;
+
+    memset(counts, 0, sizeof(counts));
+    fprintf(out, "%s.entries %u\n", name, h->entrycount);
+    fprintf(out, "%s.buckets %u\n", name, buckets);
+    fprintf(out, "%s.load_factor %.4f\n", name, buckets ? (double)h->entrycount / buckets : 0.0);
+    if (h->flags & HASHTABLE_FLAT) {
+        fprintf(out, "%s.tombstones %u\n", name, h->tombstones);
+        stats_displacement(h, counts, &longest);
+        stats_histogram(out, name, "displacement", counts);
+        fprintf(out, "%s.displacement_max %u\n", name, longest);
+    }
+    else {
+        stats_chains(h, h->table, h->length, counts, &empty, &longest);
+        if (h->oldtable != NULL)
+            stats_chains(h, h->oldtable, h->oldlength, counts, &empty, &longest);
+        stats_histogram(out, name, "chain_length", counts);
+        fprintf(out, "%s.chain_length_max %u\n", name, longest);
+        fprintf(out, "%s.empty_buckets %u\n", name, empty);
+        /* a uniform hash leaves each bucket empty with odds exp(-load) */
+        fprintf(out, "%s.empty_buckets_expected %.0f\n", name,
+                buckets ? buckets * exp(-(double)h->entrycount / buckets) : 0.0);
+    }
+
+#ifdef HASHTABLE_STATS
+    fprintf(out, "%s.lookups %llu\n", name, h->stats.lookups);
+    stats_histogram(out, name, "probe_length", h->stats.probes);
+    fprintf(out, "%s.probe_length_mean %.3f\n", name,
+            h->stats.lookups ? (double)h->stats.probetotal / h->stats.lookups : 0.0);
+    fprintf(out, "%s.probe_length_max %u\n", name, h->stats.probemax);
+    fprintf(out, "%s.eqfn_calls %llu\n", name, h->stats.eqfncalls);
+    fprintf(out, "%s.hash_short_circuits %llu\n", name, h->stats.hashskips);
+    fprintf(out, "%s.resizes %llu\n", name, h->stats.resizes);
+    fprintf(out, "%s.resize_ms_total %.3f\n", name, h->stats.resizens / 1e6);
+    fprintf(out, "%s.resize_ms_max %.3f\n", name, h->stats.resizemaxns / 1e6);
+#endif
+}
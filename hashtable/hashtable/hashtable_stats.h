@@ -0,0 +1,34 @@
+//
+//  hashtable_stats.h
+//  hashtable
+//
+//  Telemetry for hashtables. The shape of a table can always be dumped;
+//  lookup and resize counters are kept only when the library is built
+//  with -DHASHTABLE_STATS, and cost nothing otherwise.
+//
+
+#ifndef hashtable_hashtable_stats_h
+#define hashtable_hashtable_stats_h
+
+#include <stdio.h>
+#include "hashtable.h"
+
+#ifdef HASHTABLE_STATS
+/* monotonic nanoseconds, for timing resizes */
+unsigned long long hashtable_stats_clock(void);
+
+/* records a resize that began at 'start' */
+void hashtable_stats_resized(hashtable *h, unsigned long long start);
+#endif
+
+/* zeroes the counters; a no-op without HASHTABLE_STATS */
+void hashtable_stats_reset(hashtable *h);
+
+/* Writes one "<name>.<metric> <value>" line per metric to 'out'. The shape
+ * metrics walk the whole table: entries, buckets, load factor, chain
+ * lengths (flat: groups from home slot), and empty buckets next to what a
+ * uniform hash would leave empty, which exposes a bad hashfn. Lookup,
+ * eqfn and resize counters follow when built with HASHTABLE_STATS. */
+void hashtable_stats_dump(hashtable *h, const char *name, FILE *out);
+
+#endif
@@ -0,0 +1,219 @@
+//
+//  hashtable_typed.h
+//  hashtable
+//
+//  Typed open addressing tables generated by macro. Keys and values of a
+//  fixed type live inline in the slot array, so there is no allocation
+//  per entry, no pointer to chase on a compare, and hashfn/eqfn are plain
+//  functions the compiler can inline instead of calls through pointers.
+//  Probing is the HASHTABLE_FLAT scheme and shares its group helpers.
+//
+//  HASHTABLE_TYPED_DECLARE(uintmap, unsigned int, unsigned int,
+//                          typed_uint_hash, typed_uint_eq)
+//
+//  declares the type 'uintmap' and static inline functions
+//
+//      uintmap* uintmap_create(unsigned int minsize);
+//      int      uintmap_set(uintmap *h, K key, V value);     -1 / 0 on OOM
+//      V*       uintmap_get(uintmap *h, K key);              NULL if absent
+//      int      uintmap_remove(uintmap *h, K key, V *value); -1 if removed
+//      unsigned int uintmap_count(uintmap *h);
+//      void     uintmap_destroy(uintmap *h);
+//
+//  The pointer from _get stays valid until the next _set or _remove.
+//  hashfn is 'unsigned int hashfn(K)' and is run through hash_mix, eqfn
+//  is 'int eqfn(K, K)' returning non-zero on equality. Keys and values are
+//  copied by assignment and never freed by the table.
+//
+
+#ifndef hashtable_hashtable_typed_h
+#define hashtable_hashtable_typed_h
+
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable_flat.h"
+
+static inline unsigned int typed_uint_hash(unsigned int k) {
+    return k;
+}
+
+static inline int typed_uint_eq(unsigned int k1, unsigned int k2) {
+    return k1 == k2;
+}
+
+static inline unsigned int typed_u64_hash(unsigned long long k) {
+    return (unsigned int)(k ^ (k >> 32));
+}
+
+static inline int typed_u64_eq(unsigned long long k1, unsigned long long k2) {
+    return k1 == k2;
+}
+
+#define HASHTABLE_TYPED_DECLARE(name, K, V, hashfn, eqfn)                     \
+                                                                               \
+typedef struct {                                                               \
+    K key;                                                                     \
+    V value;                                                                   \
+} name##_slot;                                                                 \
+                                                                               \
+typedef struct {                                                               \
+    unsigned int length;                                                       \
+    unsigned int entrycount;                                                   \
+    unsigned int loadlimit;                                                    \
+    unsigned int tombstones;                                                   \
+    signed char *ctrl;                                                         \
+    name##_slot *slots;                                                        \
+} name;                                                                        \
+                                                                               \
+static inline int name##_alloc(name *h, unsigned int length) {                 \
+    signed char *ctrl = (signed char *)malloc(length);                         \
+    name##_slot *slots = (name##_slot *)malloc(sizeof(name##_slot) * length);  \
+    if (ctrl == NULL || slots == NULL) {                                       \
+        free(ctrl);                                                            \
+        free(slots);                                                           \
+        return 0;                                                              \
+    }                                                                          \
+    memset(ctrl, FLAT_EMPTY, length);                                          \
+    h->ctrl = ctrl;                                                            \
+    h->slots = slots;                                                          \
+    h->length = length;                                                        \
+    h->loadlimit = length - length / 8;                                        \
+    h->tombstones = 0;                                                         \
+    return -1;                                                                 \
+}                                                                              \
+                                                                               \
+static inline unsigned int name##_find_free(name *h, unsigned int hashvalue) { \
+    unsigned int groupmask = h->length / FLAT_GROUP_WIDTH - 1;                 \
+    unsigned int g = flat_h1(hashvalue) & groupmask;                           \
+    unsigned int step = 0, m;                                                  \
+    while ((m = flat_group_match_free(h->ctrl + g * FLAT_GROUP_WIDTH)) == 0) { \
+        g = (g + ++step) & groupmask;                                          \
+    }                                                                          \
+    return g * FLAT_GROUP_WIDTH + flat_lowest_bit(m);                          \
+}                                                                              \
+                                                                               \
+static inline int name##_resize(name *h, unsigned int newlength) {             \
+    signed char *oldctrl = h->ctrl;                                            \
+    name##_slot *oldslots = h->slots;                                          \
+    unsigned int oldlength = h->length;                                        \
+    unsigned int i, j;                                                         \
+    if (!name##_alloc(h, newlength)) {                                         \
+        return 0;                                                              \
+    }                                                                          \
+    for (i = 0; i < oldlength; i++) {                                          \
+        if (oldctrl[i] >= 0) {                                                 \
+            j = name##_find_free(h, hash_mix(hashfn(oldslots[i].key)));        \
+            h->ctrl[j] = oldctrl[i];                                           \
+            h->slots[j] = oldslots[i];                                         \
+        }                                                                      \
+    }                                                                          \
+    free(oldctrl);                                                             \
+    free(oldslots);                                                            \
+    return -1;                                                                 \
+}                                                                              \
+                                                                               \
+static inline name* name##_create(unsigned int minsize) {                      \
+    unsigned int length = FLAT_GROUP_WIDTH;                                    \
+    name *h = (name *)malloc(sizeof(name));                                    \
+    if (h == NULL) return NULL;                                                \
+    while (length - length / 8 < minsize && length < (1u << 31)) {             \
+        length <<= 1;                                                          \
+    }                                                                          \
+    h->entrycount = 0;                                                         \
+    if (!name##_alloc(h, length)) {                                            \
+        free(h);                                                               \
+        return NULL;                                                           \
+    }                                                                          \
+    return h;                                                                  \
+}                                                                              \
+                                                                               \
+/* slot index holding 'key', or h->length when absent */                      \
+static inline unsigned int name##_find(name *h, K key, unsigned int hashvalue) { \
+    unsigned int groupmask = h->length / FLAT_GROUP_WIDTH - 1;                 \
+    unsigned int g = flat_h1(hashvalue) & groupmask;                           \
+    unsigned int step = 0, m, i;                                               \
+    signed char tag = flat_h2(hashvalue);                                      \
+    const signed char *group;                                                  \
+    while (1) {                                                                \
+        group = h->ctrl + g * FLAT_GROUP_WIDTH;                                \
+        for (m = flat_group_match(group, tag); m != 0; m &= m - 1) {           \
+            i = g * FLAT_GROUP_WIDTH + flat_lowest_bit(m);                     \
+            if (eqfn(key, h->slots[i].key))                                    \
+                return i;                                                      \
+        }                                                                      \
+        if (flat_group_match_empty(group))                                     \
+            return h->length;                                                  \
+        g = (g + ++step) & groupmask;                                          \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static inline int name##_set(name *h, K key, V value) {                        \
+    unsigned int hashvalue = hash_mix(hashfn(key));                            \
+    unsigned int i = name##_find(h, key, hashvalue);                           \
+    unsigned int newlength;                                                    \
+    if (i != h->length) {                                                      \
+        h->slots[i].value = value;                                             \
+        return -1;                                                             \
+    }                                                                          \
+    i = name##_find_free(h, hashvalue);                                        \
+    if (h->ctrl[i] == FLAT_EMPTY && h->entrycount + h->tombstones >= h->loadlimit) { \
+        /* mostly tombstones: rebuild at the same size, otherwise grow */      \
+        newlength = h->length;                                                 \
+        if (h->entrycount >= h->loadlimit / 2) {                               \
+            if (h->length < (1u << 31)) {                                      \
+                newlength = h->length << 1;                                    \
+            }                                                                  \
+            else if (h->tombstones == 0) {                                     \
+                return 0;                                                      \
+            }                                                                  \
+        }                                                                      \
+        if (!name##_resize(h, newlength)) {                                    \
+            return 0;                                                          \
+        }                                                                      \
+        i = name##_find_free(h, hashvalue);                                    \
+    }                                                                          \
+    if (h->ctrl[i] == FLAT_DELETED) {                                          \
+        h->tombstones--;                                                       \
+    }                                                                          \
+    h->ctrl[i] = flat_h2(hashvalue);                                           \
+    h->slots[i].key = key;                                                     \
+    h->slots[i].value = value;                                                 \
+    h->entrycount++;                                                           \
+    return -1;                                                                 \
+}                                                                              \
+                                                                               \
+static inline V* name##_get(name *h, K key) {                                  \
+    unsigned int i = name##_find(h, key, hash_mix(hashfn(key)));               \
+    return i == h->length ? NULL : &h->slots[i].value;                         \
+}                                                                              \
+                                                                               \
+static inline int name##_remove(name *h, K key, V *value) {                    \
+    unsigned int i = name##_find(h, key, hash_mix(hashfn(key)));               \
+    if (i == h->length) {                                                      \
+        return 0;                                                              \
+    }                                                                          \
+    if (value != NULL) {                                                       \
+        *value = h->slots[i].value;                                            \
+    }                                                                          \
+    if (flat_group_match_empty(h->ctrl + (i & ~(FLAT_GROUP_WIDTH - 1)))) {     \
+        h->ctrl[i] = FLAT_EMPTY;                                               \
+    }                                                                          \
+    else {                                                                     \
+        h->ctrl[i] = FLAT_DELETED;                                             \
+        h->tombstones++;                                                       \
+    }                                                                          \
+    h->entrycount--;                                                           \
+    return -1;                                                                 \
+}                                                                              \
+                                                                               \
+static inline unsigned int name##_count(name *h) {                             \
+    return h->entrycount;                                                      \
+}                                                                              \
+                                                                               \
+static inline void name##_destroy(name *h) {                                   \
+    free(h->ctrl);                                                             \
+    free(h->slots);                                                            \
+    free(h);                                                                   \
+}
+
+#endif
@@ -7,12 +7,890 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "hashtable.h"
+#include "hashtable_concurrent.h"
+#include "hashtable_snapshot.h"
+#include "hashtable_typed.h"
+#include "hashtable_parallel.h"
+#include "hashtable_stats.h"
+#include "hashtable_iterator.h"
+#include "../../common/bench.h"
+
+#define DEFAULT_KEY_COUNT   10000000
+#define SNAPSHOT_PATH       "hashtable.snapshot"
+#define SUITE_MIN_KEYS      1000
+#define SUITE_MAX_KEYS      100000000
+#define SUITE_DEFAULT_KEYS  1000000
+#define SUITE_MIN_OPS       1000000
+#define SUITE_MAX_OPS       10000000
+#define SUITE_SAMPLE_EVERY  16          /* time one op in 16, the loop runs untimed */
+#define SUITE_WRITE         0x80000000u /* op flag: set (or remove) instead of get */
+
+HASHTABLE_TYPED_DECLARE(uintmap, unsigned int, unsigned int, typed_uint_hash, typed_uint_eq)
+
+typedef struct {
+    const char *name;
+    unsigned int (*hashfn)(void *k);
+    int (*eqfn)(void *k1, void *k2);
+    void *(*make)(unsigned int i);  /* the i-th distinct key, freshly allocated */
+} suite_keytype;
+
+/* Gray et al. zipfian sampler over [0, n), theta 0.99 as in YCSB */
+typedef struct {
+    unsigned int n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} suite_zipf;
+
+unsigned int uint_hash(void *k);
+int uint_eq(void *k1, void *k2);
+void bench_index(unsigned int tablelength, unsigned int count);
+void bench_sizing(const char *name, unsigned int flags, unsigned int **keys, unsigned int count);
+int compare_double(const void *a, const void *b);
+void bench_latency(const char *name, unsigned int flags, unsigned int **keys, unsigned int count);
+void bench_teardown(const char *name, unsigned int flags, unsigned int **keys, unsigned int count);
+unsigned int **make_keys(unsigned int count);
+void bench_batch(const char *name, unsigned int flags, unsigned int **keys, unsigned int count);
+size_t uint_size(void *k);
+void bench_snapshot(unsigned int **keys, unsigned int count);
+void bench_typed(unsigned int **keys, unsigned int count);
+void sum_values(void *ctx, void *k, void *v, unsigned int part);
+void bench_parallel(unsigned int threads, unsigned int **keys, unsigned int count);
+void dump_stats(const char *name, unsigned int flags, unsigned int **keys, unsigned int count);
+unsigned int str_hash(void *k);
+int str_eq(void *k1, void *k2);
+void *make_uint_key(unsigned int i);
+void *make_str_key(unsigned int i);
+unsigned int suite_rand(unsigned int *state);
+void suite_zipf_init(suite_zipf *z, unsigned int n);
+unsigned int suite_zipf_next(suite_zipf *z, unsigned int *state);
+void suite_ops(unsigned int *ops, unsigned int count, const char *dist, unsigned int n, unsigned int write_percent, int paired, suite_zipf *z, unsigned int seed);
+size_t table_bytes(hashtable *h);
+void **suite_keys(const suite_keytype *kt, unsigned int n);
+double suite_run(hashtable *h, const char *workload, const suite_keytype *kt, void **keys, const unsigned int *ops, unsigned int count, double *samples);
+double suite_timer_overhead(void);
+void suite_report(const char *backend, const char *keys, const char *dist, const char *workload, unsigned int size, unsigned int count, double total_ns, double *samples, hashtable *h);
+void bench_suite(unsigned int maxkeys);
+void bench_iterate(unsigned int percent, unsigned int **keys, unsigned int count);
+void *threads_worker(void *args);
+void bench_threads(unsigned int **keys, unsigned int count);
+
+typedef struct {
+    hashtable *h;                   /* with 'lock', or */
+    pthread_mutex_t *lock;
+    chashtable *ch;                 /* lock-free readers, striped writers */
+    unsigned int **keys;
+    unsigned int keycount;
+    unsigned int ops;
+    unsigned int get_percent;
+    unsigned int seed;
+} threadargs;
+
+unsigned int uint_hash(void *k) {
+    return *(unsigned int *)k;
+}
+
+int uint_eq(void *k1, void *k2) {
+    return *(unsigned int *)k1 == *(unsigned int *)k2;
+}
+
+/* cost of indexFor() alone, without the bucket loads that follow it */
+void bench_index(unsigned int tablelength, unsigned int count) {
+    volatile unsigned int length = tablelength; // keep the divisor opaque
+    unsigned int i, sum = 0, hashvalue = 0x9e3779b9u;
+    double start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hashvalue = hashvalue * 1664525u + 1013904223u;
+        sum += indexFor(length, hashvalue);
+    }
+    printf("indexFor     %10u length %9.2f ns/op  (checksum %u)\n",
+           tablelength, (bench_now_ns() - start) / count, sum);
+}
+
+/* grows a table from empty to 'count' keys, then looks every key up again */
+void bench_sizing(const char *name, unsigned int flags, unsigned int **keys, unsigned int count) {
+    hashtable_options options = { flags, NULL };
+    hashtable *h = hashtable_create_with_options(16, uint_hash, uint_eq, &options);
+    unsigned int i, hits = 0;
+    double start, insert_ns, lookup_ns;
+    if (h == NULL) {
+        return;
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hashtable_set(h, keys[i], keys[i]);
+    }
+    insert_ns = (bench_now_ns() - start) / count;
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (hashtable_get(h, keys[(i * 7919u) % count]) != NULL) {
+            hits++;
+        }
+    }
+    lookup_ns = (bench_now_ns() - start) / count;
+
+    printf("%-12s %10u keys %10u buckets  insert %7.1f ns/op  lookup %7.1f ns/op  (%u hits)\n",
+           name, count, h->length, insert_ns, lookup_ns, hits);
+
+    // the table owns the keys; the values are the same pointers
+    hashtable_destroy(h, 0);
+}
+
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* times every insert on its own; expansions show up in the tail */
+void bench_latency(const char *name, unsigned int flags, unsigned int **keys, unsigned int count) {
+    hashtable_options options = { flags, NULL };
+    hashtable *h = hashtable_create_with_options(16, uint_hash, uint_eq, &options);
+    double *samples = (double *)malloc(sizeof(double) * count);
+    double start, total = 0;
+    unsigned int i;
+    if (h == NULL || samples == NULL) {
+        free(samples);
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        start = bench_now_ns();
+        hashtable_set(h, keys[i], keys[i]);
+        samples[i] = bench_now_ns() - start;
+        total += samples[i];
+    }
+    qsort(samples, count, sizeof(double), compare_double);
+    printf("%-12s %10u inserts  mean %7.1f  p50 %7.1f  p99 %9.1f  p99.9 %9.1f  max %12.1f ns\n",
+           name, count, total / count, samples[count / 2], samples[(unsigned int)(count * 0.99)],
+           samples[(unsigned int)(count * 0.999)], samples[count - 1]);
+    free(samples);
+    hashtable_destroy(h, 0);
+}
+
+/* fill, churn a tenth of the keys through remove/set, then time destroy */
+void bench_teardown(const char *name, unsigned int flags, unsigned int **keys, unsigned int count) {
+    hashtable_options options = { flags, NULL };
+    hashtable *h = hashtable_create_with_options(16, uint_hash, uint_eq, &options);
+    double start, fill_ns, destroy_ns;
+    unsigned int i, key;
+    if (h == NULL) {
+        return;
+    }
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hashtable_set(h, keys[i], keys[i]);
+    }
+    for (i = 0; i < count; i += 10) {
+        key = *keys[i];
+        hashtable_remove(h, &key);
+        keys[i] = (unsigned int *)malloc(sizeof(unsigned int));
+        *keys[i] = key;
+        hashtable_set(h, keys[i], keys[i]);
+    }
+    fill_ns = (bench_now_ns() - start) / count;
+    start = bench_now_ns();
+    hashtable_destroy(h, 0);
+    destroy_ns = bench_now_ns() - start;
+    printf("%-12s %10u keys  fill %7.1f ns/op  destroy %10.3f ms\n",
+           name, count, fill_ns, destroy_ns / 1e6);
+}
+
+/* the same random lookups one hashtable_get at a time and in batches */
+void bench_batch(const char *name, unsigned int flags, unsigned int **keys, unsigned int count) {
+    hashtable_options options = { flags, NULL };
+    hashtable *h = hashtable_create_with_options(count, uint_hash, uint_eq, &options);
+    unsigned int batch = 256;
+    void **queries = (void **)malloc(sizeof(void *) * count);
+    void **values = (void **)malloc(sizeof(void *) * batch);
+    double start, single_ns, many_ns;
+    unsigned int i, j, n;
+    if (h == NULL || queries == NULL || values == NULL) {
+        free(queries);
+        free(values);
+        return;
+    }
+    hashtable_set_many(h, (void **)keys, (void **)keys, count);
+    for (i = 0; i < count; i++) {
+        queries[i] = keys[(i * 7919u) % count];
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hashtable_get(h, queries[i]);
+    }
+    single_ns = (bench_now_ns() - start) / count;
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i += n) {
+        n = count - i < batch ? count - i : batch;
+        hashtable_get_many(h, queries + i, values, n);
+        for (j = 0; j < n; j++) {
+            if (values[j] != queries[i + j]) {
+                printf("get_many returned a wrong value\n");
+                break;
+            }
+        }
+    }
+    many_ns = (bench_now_ns() - start) / count;
+
+    printf("%-12s %10u keys  get %7.1f ns/op  get_many(%u) %7.1f ns/op  %.2fx\n",
+           name, count, single_ns, batch, many_ns, single_ns / many_ns);
+    free(queries);
+    free(values);
+    hashtable_destroy(h, 0);
+}
+
+void *threads_worker(void *args) {
+    threadargs *a = (threadargs *)args;
+    unsigned int x = a->seed, i, key;
+    for (i = 0; i < a->ops; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        // overwrites only, so the table never keeps this stack key
+        key = *a->keys[x % a->keycount];
+        if (x % 100 < a->get_percent) {
+            if (a->ch != NULL) {
+                chashtable_get(a->ch, &key);
+            }
+            else {
+                pthread_mutex_lock(a->lock);
+                hashtable_get(a->h, &key);
+                pthread_mutex_unlock(a->lock);
+            }
+        }
+        else {
+            if (a->ch != NULL) {
+                chashtable_set(a->ch, &key, NULL);
+            }
+            else {
+                pthread_mutex_lock(a->lock);
+                hashtable_set(a->h, &key, NULL);
+                pthread_mutex_unlock(a->lock);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* 1..64 threads sharing 'count' operations on a table of 'count' keys:
+ * one global mutex around a hashtable versus the concurrent table */
+void bench_threads(unsigned int **keys, unsigned int count) {
+    unsigned int get_percents[] = { 100, 90, 50 };
+    unsigned int threadcounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    pthread_t threads[64];
+    threadargs args[64];
+    pthread_mutex_t lock;
+    hashtable *h = hashtable_create_with_options(count, uint_hash, uint_eq, NULL);
+    chashtable *ch = chashtable_create(count, uint_hash, uint_eq);
+    unsigned int i, g, t, n, variant;
+    double start;
+    if (h == NULL || ch == NULL) {
+        return;
+    }
+    pthread_mutex_init(&lock, NULL);
+    for (i = 0; i < count; i++) {
+        hashtable_set(h, keys[i], NULL);
+        // both tables own their keys
+        unsigned int *key = (unsigned int *)malloc(sizeof(unsigned int));
+        *key = *keys[i];
+        chashtable_set(ch, key, NULL);
+    }
+    for (g = 0; g < sizeof(get_percents) / sizeof(get_percents[0]); g++) {
+        for (t = 0; t < sizeof(threadcounts) / sizeof(threadcounts[0]); t++) {
+            for (variant = 0; variant < 2; variant++) {
+                n = threadcounts[t];
+                for (i = 0; i < n; i++) {
+                    args[i].h = h;
+                    args[i].lock = &lock;
+                    args[i].ch = variant == 1 ? ch : NULL;
+                    args[i].keys = keys;
+                    args[i].keycount = count;
+                    args[i].ops = count / n;
+                    args[i].get_percent = get_percents[g];
+                    args[i].seed = 2463534242u + i * 7919u;
+                }
+                start = bench_now_ns();
+                for (i = 0; i < n; i++) {
+                    pthread_create(&threads[i], NULL, threads_worker, &args[i]);
+                }
+                for (i = 0; i < n; i++) {
+                    pthread_join(threads[i], NULL);
+                }
+                printf("%-12s %3u%% get %2u threads  %12.0f ops/s\n",
+                       variant == 1 ? "concurrent" : "mutex", get_percents[g], n,
+                       (count / n) * n / ((bench_now_ns() - start) / 1e9));
+            }
+        }
+    }
+    pthread_mutex_destroy(&lock);
+    hashtable_destroy(h, 0);
+    chashtable_destroy(ch, 0);
+}
+
+size_t uint_size(void *k) {
+    return sizeof(unsigned int);
+}
+
+/* rebuilding with hashtable_set against opening a saved image */
+void bench_snapshot(unsigned int **keys, unsigned int count) {
+    hashtable_options options = { HASHTABLE_POW2, NULL };
+    hashtable *h = hashtable_create_with_options(16, uint_hash, uint_eq, &options);
+    hashtable_snapshot *s;
+    double start, build_ms, save_ms, open_ms, get_ns;
+    unsigned int i, missing = 0;
+    if (h == NULL) {
+        return;
+    }
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hashtable_set(h, keys[i], keys[i]);
+    }
+    build_ms = (bench_now_ns() - start) / 1e6;
+
+    start = bench_now_ns();
+    if (!hashtable_snapshot_save(h, SNAPSHOT_PATH, uint_size, uint_size)) {
+        printf("snapshot save failed\n");
+        hashtable_destroy(h, 0);
+        return;
+    }
+    save_ms = (bench_now_ns() - start) / 1e6;
+
+    start = bench_now_ns();
+    s = hashtable_snapshot_open(SNAPSHOT_PATH, uint_hash, uint_eq);
+    open_ms = (bench_now_ns() - start) / 1e6;
+    if (s == NULL) {
+        printf("snapshot open failed\n");
+        hashtable_destroy(h, 0);
+        return;
+    }
+    /* the first pass over the image pays the page faults */
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        const unsigned int *v = (const unsigned int *)hashtable_snapshot_get(s, keys[(i * 7919u) % count]);
+        if (v == NULL || *v != *keys[(i * 7919u) % count]) {
+            missing++;
+        }
+    }
+    get_ns = (bench_now_ns() - start) / count;
+    printf("snapshot     %10u keys  build %10.3f ms  save %10.3f ms  open %7.3f ms  get %7.1f ns/op%s\n",
+           count, build_ms, save_ms, open_ms, get_ns, missing ? "  MISMATCH" : "");
+    hashtable_snapshot_close(s);
+    remove(SNAPSHOT_PATH);
+    /* the table owns the keys the lookups above still needed */
+    hashtable_destroy(h, 0);
+}
+
+/* pointer keys through hashfn/eqfn pointers against inline typed slots */
+void bench_typed(unsigned int **keys, unsigned int count) {
+    hashtable_options options = { HASHTABLE_FLAT, NULL };
+    hashtable *h = hashtable_create_with_options(16, uint_hash, uint_eq, &options);
+    uintmap *m = uintmap_create(16);
+    double start, fill_ns, get_ns, typed_fill_ns, typed_get_ns;
+    unsigned int i, sum = 0;
+    if (h == NULL || m == NULL) {
+        if (h != NULL) hashtable_destroy(h, 0);
+        if (m != NULL) uintmap_destroy(m);
+        return;
+    }
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hashtable_set(h, keys[i], keys[i]);
+    }
+    fill_ns = (bench_now_ns() - start) / count;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        sum += *(unsigned int *)hashtable_get(h, keys[(i * 7919u) % count]);
+    }
+    get_ns = (bench_now_ns() - start) / count;
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        uintmap_set(m, *keys[i], *keys[i]);
+    }
+    typed_fill_ns = (bench_now_ns() - start) / count;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        sum -= *uintmap_get(m, *keys[(i * 7919u) % count]);
+    }
+    typed_get_ns = (bench_now_ns() - start) / count;
+
+    printf("flat         %10u keys  set %7.1f ns/op  get %7.1f ns/op\n", count, fill_ns, get_ns);
+    printf("typed        %10u keys  set %7.1f ns/op  get %7.1f ns/op%s\n",
+           count, typed_fill_ns, typed_get_ns, sum != 0 ? "  MISMATCH" : "");
+    uintmap_destroy(m);
+    hashtable_destroy(h, 0);
+}
+
+void sum_values(void *ctx, void *k, void *v, unsigned int part) {
+    ((unsigned long long *)ctx)[part * 8] += *(unsigned int *)v;
+}
+
+/* bulk load and full scan on 'threads' threads; 1 is the serial path */
+void bench_parallel(unsigned int threads, unsigned int **keys, unsigned int count) {
+    unsigned long long sums[HASHTABLE_MAX_THREADS * 8];
+    unsigned long long total = 0;
+    hashtable_options options = { HASHTABLE_POW2, NULL };
+    hashtable *h = hashtable_create_with_options(16, uint_hash, uint_eq, &options);
+    double start, load_ms, scan_ms;
+    unsigned int t;
+    if (h == NULL) {
+        return;
+    }
+    start = bench_now_ns();
+    hashtable_load_parallel(h, (void **)keys, (void **)keys, count, threads);
+    load_ms = (bench_now_ns() - start) / 1e6;
+
+    /* 8 apart: each thread's sum on its own cache line */
+    memset(sums, 0, sizeof(sums));
+    start = bench_now_ns();
+    hashtable_foreach_parallel(h, threads, sum_values, sums);
+    scan_ms = (bench_now_ns() - start) / 1e6;
+    for (t = 0; t < threads; t++) {
+        total += sums[t * 8];
+    }
+    printf("parallel %2u  %10u keys  load %10.3f ms  scan %10.3f ms  sum %llu\n",
+           threads, count, load_ms, scan_ms, total);
+    hashtable_destroy(h, 0);
+}
+
+/* table shape, plus lookup/resize counters in -DHASHTABLE_STATS builds */
+void dump_stats(const char *name, unsigned int flags, unsigned int **keys, unsigned int count) {
+    hashtable_options options = { flags, NULL };
+    hashtable *h = hashtable_create_with_options(16, uint_hash, uint_eq, &options);
+    unsigned int i;
+    if (h == NULL) {
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        hashtable_set(h, keys[i], keys[i]);
+    }
+    for (i = 0; i < count; i++) {
+        hashtable_get(h, keys[(i * 7919u) % count]);
+    }
+    hashtable_stats_dump(h, name, stdout);
+    hashtable_destroy(h, 0);
+}
+
+/* FNV-1a */
+unsigned int str_hash(void *k) {
+    const unsigned char *s = (const unsigned char *)k;
+    unsigned int h = 2166136261u;
+    while (*s) {
+        h ^= *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int str_eq(void *k1, void *k2) {
+    return strcmp((const char *)k1, (const char *)k2) == 0;
+}
+
+void *make_uint_key(unsigned int i) {
+    unsigned int *k = (unsigned int *)malloc(sizeof(unsigned int));
+    if (k != NULL) {
+        *k = i * 2654435761u;
+    }
+    return k;
+}
+
+void *make_str_key(unsigned int i) {
+    char buffer[24];
+    int length = snprintf(buffer, sizeof(buffer), "key:%010u", i * 2654435761u);
+    char *k = (char *)malloc(length + 1);
+    if (k != NULL) {
+        memcpy(k, buffer, length + 1);
+    }
+    return k;
+}
+
+/* xorshift32 */
+unsigned int suite_rand(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+void suite_zipf_init(suite_zipf *z, unsigned int n) {
+    double zeta2 = 0;
+    unsigned int i;
+    z->n = n;
+    z->theta = 0.99;
+    z->alpha = 1.0 / (1.0 - z->theta);
+    z->zetan = 0;
+    for (i = 1; i <= n; i++) {
+        z->zetan += 1.0 / pow(i, z->theta);
+        if (i == 2) {
+            zeta2 = z->zetan;
+        }
+    }
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - z->theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+unsigned int suite_zipf_next(suite_zipf *z, unsigned int *state) {
+    double u = suite_rand(state) / 4294967296.0;
+    double uz = u * z->zetan;
+    unsigned int rank;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, z->theta)) return 1;
+    rank = (unsigned int)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return rank < z->n ? rank : z->n - 1;
+}
+
+/* Fills 'ops' with key indices drawn from 'dist', flagged SUITE_WRITE with
+ * 'write_percent' odds. 'paired' repeats each index with the flag set, so
+ * a churn run removes a key and then inserts it again. */
+void suite_ops(unsigned int *ops, unsigned int count, const char *dist, unsigned int n, unsigned int write_percent, int paired, suite_zipf *z, unsigned int seed) {
+    unsigned int state = seed, i, index;
+    for (i = 0; i < count; i += paired ? 2 : 1) {
+        if (strcmp(dist, "uniform") == 0)
+            index = suite_rand(&state) % n;
+        else if (strcmp(dist, "zipf") == 0)
+            index = suite_zipf_next(z, &state);
+        else
+            index = i % n;
+        if (paired) {
+            ops[i] = index;
+            if (i + 1 < count)
+                ops[i + 1] = index | SUITE_WRITE;
+        }
+        else {
+            ops[i] = suite_rand(&state) % 100 < write_percent ? index | SUITE_WRITE : index;
+        }
+    }
+}
+
+/* bytes the table itself owns; the caller's keys and values not included */
+size_t table_bytes(hashtable *h) {
+    if (h->flags & HASHTABLE_FLAT) {
+        return (size_t)h->length * (1 + sizeof(flat_slot));
+    }
+    return ((size_t)h->length + h->oldlength) * sizeof(entry *) + (size_t)h->entrycount * sizeof(entry);
+}
+
+void **suite_keys(const suite_keytype *kt, unsigned int n) {
+    void **keys = (void **)malloc(sizeof(void *) * n);
+    unsigned int i;
+    if (keys == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        if ((keys[i] = kt->make(i)) == NULL) {
+            while (i > 0) free(keys[--i]);
+            free(keys);
+            return NULL;
+        }
+    }
+    return keys;
+}
+
+/* runs 'count' ops and returns the wall time; every SUITE_SAMPLE_EVERY-th
+ * op is timed on its own into 'samples' */
+double suite_run(hashtable *h, const char *workload, const suite_keytype *kt, void **keys, const unsigned int *ops, unsigned int count, double *samples) {
+    int insert = strcmp(workload, "insert") == 0;
+    int churn = strcmp(workload, "churn") == 0;
+    double start = bench_now_ns(), opstart = 0;
+    unsigned int i, index;
+    for (i = 0; i < count; i++) {
+        index = ops[i] & ~SUITE_WRITE;
+        if (i % SUITE_SAMPLE_EVERY == 0)
+            opstart = bench_now_ns();
+        if (insert) {
+            hashtable_set(h, keys[index], NULL);
+        }
+        else if (churn) {
+            /* the table frees removed keys; the insert brings a fresh copy */
+            if (ops[i] & SUITE_WRITE) {
+                keys[index] = kt->make(index);
+                hashtable_set(h, keys[index], NULL);
+            }
+            else {
+                hashtable_remove(h, keys[index]);
+            }
+        }
+        else if (ops[i] & SUITE_WRITE) {
+            hashtable_set(h, keys[index], NULL);
+        }
+        else {
+            hashtable_get(h, keys[index]);
+        }
+        if (i % SUITE_SAMPLE_EVERY == 0)
+            samples[i / SUITE_SAMPLE_EVERY] = bench_now_ns() - opstart;
+    }
+    return bench_now_ns() - start;
+}
+
+/* median cost of reading the clock twice, taken off every timed op */
+double suite_timer_overhead(void) {
+    double samples[1001], start;
+    unsigned int i;
+    for (i = 0; i < 1001; i++) {
+        start = bench_now_ns();
+        samples[i] = bench_now_ns() - start;
+    }
+    qsort(samples, 1001, sizeof(double), compare_double);
+    return samples[500];
+}
+
+void suite_report(const char *backend, const char *keys, const char *dist, const char *workload, unsigned int size, unsigned int count, double total_ns, double *samples, hashtable *h) {
+    unsigned int n = (count + SUITE_SAMPLE_EVERY - 1) / SUITE_SAMPLE_EVERY;
+    double overhead = suite_timer_overhead();
+    unsigned int i;
+    for (i = 0; i < n; i++) {
+        samples[i] = samples[i] > overhead ? samples[i] - overhead : 0;
+    }
+    qsort(samples, n, sizeof(double), compare_double);
+    printf("%s,%s,%s,%s,%u,%u,%.0f,%.1f,%.0f,%.0f,%.0f,%.0f,%.0f,%.1f\n",
+           backend, keys, dist, workload, size, count, count / (total_ns / 1e9), total_ns / count,
+           samples[n / 2], samples[(unsigned int)(n * 0.9)], samples[(unsigned int)(n * 0.99)],
+           samples[(unsigned int)(n * 0.999)], samples[n - 1],
+           h->entrycount ? (double)table_bytes(h) / h->entrycount : 0.0);
+    fflush(stdout);
+}
+
+/* Every backend x key type x size from 1K to 'maxkeys', as CSV on stdout.
+ * insert fills an empty table in key order or shuffled; read (5% sets),
+ * mixed (50% sets) and churn (remove then re-insert) then run on the
+ * shuffled fill with uniform, zipfian and sequential key choice. */
+void bench_suite(unsigned int maxkeys) {
+    const char *backends[] = { "prime", "pow2", "flat" };
+    unsigned int flags[] = { HASHTABLE_CHAINED, HASHTABLE_POW2, HASHTABLE_FLAT };
+    const suite_keytype keytypes[] = {
+        { "int", uint_hash, uint_eq, make_uint_key },
+        { "string", str_hash, str_eq, make_str_key }
+    };
+    const char *dists[] = { "uniform", "zipf", "sequential" };
+    const char *workloads[] = { "read", "mixed", "churn" };
+    unsigned int writes[] = { 5, 50, 0 };
+    unsigned int size, count, b, k, d, w, i, state;
+    unsigned int *ops;
+    double *samples;
+    double total;
+    void **keys;
+    hashtable *h;
+    hashtable_options options;
+    suite_zipf zipf;
+
+    printf("backend,keys,dist,workload,size,ops,ops_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,bytes_per_entry\n");
+    for (size = SUITE_MIN_KEYS; size <= maxkeys && size <= SUITE_MAX_KEYS; size *= 10) {
+        count = size < SUITE_MIN_OPS ? SUITE_MIN_OPS : size > SUITE_MAX_OPS ? SUITE_MAX_OPS : size;
+        ops = (unsigned int *)malloc(sizeof(unsigned int) * (count > size ? count : size));
+        samples = (double *)malloc(sizeof(double) * (count / SUITE_SAMPLE_EVERY + 1));
+        if (ops == NULL || samples == NULL) {
+            free(ops);
+            free(samples);
+            return;
+        }
+        suite_zipf_init(&zipf, size);
+        for (b = 0; b < 3; b++) {
+            options.flags = flags[b];
+            options.allocator = NULL;
+            for (k = 0; k < 2; k++) {
+                /* insert twice: in key order, then shuffled; keep the second table */
+                h = NULL;
+                for (d = 0; d < 2; d++) {
+                    if (h != NULL) {
+                        hashtable_destroy(h, 0);
+                        free(keys);
+                    }
+                    keys = suite_keys(&keytypes[k], size);
+                    h = hashtable_create_with_options(16, keytypes[k].hashfn, keytypes[k].eqfn, &options);
+                    if (keys == NULL || h == NULL) {
+                        printf("# out of memory at %u keys\n", size);
+                        if (h != NULL) hashtable_destroy(h, 0);
+                        free(keys);
+                        free(ops);
+                        free(samples);
+                        return;
+                    }
+                    for (i = 0; i < size; i++) {
+                        ops[i] = i;
+                    }
+                    state = 2463534242u;
+                    for (i = size - 1; d == 1 && i > 0; i--) {
+                        unsigned int j = suite_rand(&state) % (i + 1), t = ops[i];
+                        ops[i] = ops[j];
+                        ops[j] = t;
+                    }
+                    total = suite_run(h, "insert", &keytypes[k], keys, ops, size, samples);
+                    suite_report(backends[b], keytypes[k].name, d == 0 ? "sequential" : "uniform", "insert",
+                                 size, size, total, samples, h);
+                }
+                for (d = 0; d < 3; d++) {
+                    for (w = 0; w < 3; w++) {
+                        suite_ops(ops, count, dists[d], size, writes[w], strcmp(workloads[w], "churn") == 0,
+                                  &zipf, 2463534242u + d * 3 + w);
+                        total = suite_run(h, workloads[w], &keytypes[k], keys, ops, count, samples);
+                        suite_report(backends[b], keytypes[k].name, dists[d], workloads[w],
+                                     size, count, total, samples, h);
+                    }
+                }
+                hashtable_destroy(h, 0);
+                free(keys);
+            }
+        }
+        free(ops);
+        free(samples);
+    }
+}
+
+/* full scans of a table sized for 'count' keys but holding 'percent' of them */
+void bench_iterate(unsigned int percent, unsigned int **keys, unsigned int count) {
+    hashtable *h = hashtable_create(count, uint_hash, uint_eq);
+    hashtable_iterator *itr;
+    unsigned int fill = (unsigned int)((unsigned long long)count * percent / 100);
+    unsigned int i, seen = 0;
+    double start, scan_ms;
+    if (h == NULL) {
+        return;
+    }
+    for (i = 0; i < fill; i++) {
+        hashtable_set(h, keys[i], keys[i]);
+    }
+    start = bench_now_ns();
+    if ((itr = hashtable_iterator_create(h)) != NULL) {
+        if (hashtable_iterator_valid(itr)) {
+            do {
+                seen++;
+            } while (hashtable_iterator_advance(itr));
+        }
+        free(itr);
+    }
+    scan_ms = (bench_now_ns() - start) / 1e6;
+    printf("iterate %3u%% %10u buckets %10u entries  scan %10.3f ms  %7.2f ns/entry\n",
+           percent, h->length, seen, scan_ms, seen ? scan_ms * 1e6 / seen : 0.0);
+    /* keys past 'fill' never went in, the table owns the rest */
+    for (i = fill; i < count; i++) {
+        free(keys[i]);
+    }
+    hashtable_destroy(h, 0);
+}
+
+/* odd multiplier: distinct, scattered keys, owned by the table they go into */
+unsigned int **make_keys(unsigned int count) {
+    unsigned int **keys = (unsigned int **)malloc(sizeof(unsigned int *) * count);
+    unsigned int i;
+    if (keys == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        keys[i] = (unsigned int *)malloc(sizeof(unsigned int));
+        *keys[i] = i * 2654435761u;
+    }
+    return keys;
+}
 
 int main (int argc, const char * argv[])
 {
+    const char *bench = argc > 1 ? argv[1] : "all";
+    unsigned int count = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : DEFAULT_KEY_COUNT;
+    unsigned int **keys;
+    int all = strcmp(bench, "all") == 0;
+    if (count == 0) {
+        fprintf(stderr, "usage: hashtable [all|sizing|latency|teardown|threads|batch|snapshot|typed|parallel|stats|iterate|suite] [keys]\n");
+        return 1;
+    }
+    /* CSV only, so the output can be diffed between releases */
+    if (strcmp(bench, "suite") == 0) {
+        bench_suite(argc > 2 ? count : SUITE_DEFAULT_KEYS);
+        return 0;
+    }
 
-    // insert code here...
-    printf("Welcome to my hashtable...Please test it for me.\n");
+    printf("Welcome to my hashtable...\n");
+    if (all || strcmp(bench, "sizing") == 0) {
+        const char *names[] = { "prime", "pow2", "flat" };
+        unsigned int flags[] = { HASHTABLE_CHAINED, HASHTABLE_POW2, HASHTABLE_FLAT };
+        unsigned int round;
+        bench_index(25165843, count);
+        bench_index(1u << 24, count);
+        for (round = 0; round < 3; round++) {
+            if ((keys = make_keys(count)) == NULL) return 1;
+            bench_sizing(names[round], flags[round], keys, count);
+            free(keys);
+        }
+    }
+    if (all || strcmp(bench, "latency") == 0) {
+        const char *names[] = { "expand", "incremental" };
+        unsigned int flags[] = { HASHTABLE_POW2, HASHTABLE_POW2 | HASHTABLE_INCREMENTAL };
+        unsigned int round;
+        for (round = 0; round < 2; round++) {
+            if ((keys = make_keys(count)) == NULL) return 1;
+            bench_latency(names[round], flags[round], keys, count);
+            free(keys);
+        }
+    }
+    if (all || strcmp(bench, "teardown") == 0) {
+        const char *names[] = { "malloc", "slab" };
+        unsigned int flags[] = { HASHTABLE_POW2, HASHTABLE_POW2 | HASHTABLE_SLAB };
+        unsigned int round;
+        for (round = 0; round < 2; round++) {
+            if ((keys = make_keys(count)) == NULL) return 1;
+            bench_teardown(names[round], flags[round], keys, count);
+            free(keys);
+        }
+    }
+    if (all || strcmp(bench, "batch") == 0) {
+        const char *names[] = { "chained", "flat" };
+        unsigned int flags[] = { HASHTABLE_POW2, HASHTABLE_FLAT };
+        unsigned int round;
+        for (round = 0; round < 2; round++) {
+            if ((keys = make_keys(count)) == NULL) return 1;
+            bench_batch(names[round], flags[round], keys, count);
+            free(keys);
+        }
+    }
+    if (all || strcmp(bench, "snapshot") == 0) {
+        if ((keys = make_keys(count)) == NULL) return 1;
+        bench_snapshot(keys, count);
+        free(keys);
+    }
+    if (all || strcmp(bench, "typed") == 0) {
+        if ((keys = make_keys(count)) == NULL) return 1;
+        bench_typed(keys, count);
+        free(keys);
+    }
+    if (all || strcmp(bench, "parallel") == 0) {
+        unsigned int threads[] = { 1, 2, 4, 8, 16 };
+        unsigned int round;
+        for (round = 0; round < 5; round++) {
+            if ((keys = make_keys(count)) == NULL) return 1;
+            bench_parallel(threads[round], keys, count);
+            free(keys);
+        }
+    }
+    if (all || strcmp(bench, "iterate") == 0) {
+        unsigned int percents[] = { 1, 10, 100 };
+        unsigned int round;
+        for (round = 0; round < 3; round++) {
+            if ((keys = make_keys(count)) == NULL) return 1;
+            bench_iterate(percents[round], keys, count);
+            free(keys);
+        }
+    }
+    if (strcmp(bench, "stats") == 0) {
+        const char *names[] = { "prime", "pow2", "flat" };
+        unsigned int flags[] = { HASHTABLE_CHAINED, HASHTABLE_POW2, HASHTABLE_FLAT };
+        unsigned int round;
+        for (round = 0; round < 3; round++) {
+            if ((keys = make_keys(count)) == NULL) return 1;
+            dump_stats(names[round], flags[round], keys, count);
+            free(keys);
+        }
+    }
+    if (all || strcmp(bench, "threads") == 0) {
+        if ((keys = make_keys(count)) == NULL) return 1;
+        bench_threads(keys, count);
+        free(keys);
+    }
     return 0;
 }
-
@@ -0,0 +1,400 @@
+//
+//  btree.c
+//  red-black-tree
+//
+//  B+-tree with SIMD node search, see btree.h.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) && defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+#include "btree.h"
+
+#define BTREE_INNER(n)  ((btree_inner *)(n))
+#define BTREE_LEAF(n)   ((btree_leaf *)(n))
+
+/* two keys per compare below AVX2 */
+#if defined(__SSE4_2__) && !defined(__AVX2__)
+#define BTREE_SSE
+#define btree_cmpgt_epi64   _mm_cmpgt_epi64
+#elif defined(__SSE2__) && defined(__x86_64__) && !defined(__AVX2__)
+#define BTREE_SSE
+/* SSE2 has no 64 bit compare. Where the high halves are equal, b - a
+ * borrows into the high half exactly when a's low half is above b's; else
+ * the signed compare of the high halves decides. The high half of each
+ * lane is then copied to the low one. */
+static inline __m128i btree_cmpgt_epi64(__m128i a, __m128i b) {
+    __m128i r = _mm_and_si128(_mm_cmpeq_epi32(a, b), _mm_sub_epi64(b, a));
+    r = _mm_or_si128(r, _mm_cmpgt_epi32(a, b));
+    return _mm_shuffle_epi32(r, _MM_SHUFFLE(3, 3, 1, 1));
+}
+#endif
+
+/* number of keys below 'key'; the padding never is */
+static inline unsigned int btree_count_below(const btree_node *n, btree_key key) {
+#if defined(__AVX2__)
+    __m256i k = _mm256_set1_epi64x(key), acc = _mm256_setzero_si256();
+    __m128i sum;
+    unsigned int i;
+    for (i = 0; i < BTREE_ORDER; i += 4) {
+        acc = _mm256_sub_epi64(acc, _mm256_cmpgt_epi64(k, _mm256_load_si256((const __m256i *)&n->keys[i])));
+    }
+    sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    return (unsigned int)(_mm_cvtsi128_si64(sum) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum)));
+#elif defined(BTREE_SSE)
+    __m128i k = _mm_set1_epi64x(key), acc = _mm_setzero_si128();
+    unsigned int i;
+    for (i = 0; i < BTREE_ORDER; i += 2) {
+        acc = _mm_sub_epi64(acc, btree_cmpgt_epi64(k, _mm_load_si128((const __m128i *)&n->keys[i])));
+    }
+    return (unsigned int)(_mm_cvtsi128_si64(acc) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc)));
+#else
+    unsigned int i, below = 0;
+    for (i = 0; i < BTREE_ORDER; i++) {
+        below += n->keys[i] < key;
+    }
+    return below;
+#endif
+}
+
+/* number of keys not above 'key', i.e. the child of an inner node to descend into */
+static inline unsigned int btree_count_upto(const btree_node *n, btree_key key) {
+    unsigned int above;
+#if defined(__AVX2__)
+    __m256i k = _mm256_set1_epi64x(key), acc = _mm256_setzero_si256();
+    __m128i sum;
+    unsigned int i;
+    for (i = 0; i < BTREE_ORDER; i += 4) {
+        acc = _mm256_sub_epi64(acc, _mm256_cmpgt_epi64(_mm256_load_si256((const __m256i *)&n->keys[i]), k));
+    }
+    sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    above = (unsigned int)(_mm_cvtsi128_si64(sum) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum)));
+#elif defined(BTREE_SSE)
+    __m128i k = _mm_set1_epi64x(key), acc = _mm_setzero_si128();
+    unsigned int i;
+    for (i = 0; i < BTREE_ORDER; i += 2) {
+        acc = _mm_sub_epi64(acc, btree_cmpgt_epi64(_mm_load_si128((const __m128i *)&n->keys[i]), k));
+    }
+    above = (unsigned int)(_mm_cvtsi128_si64(acc) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc)));
+#else
+    unsigned int i;
+    above = 0;
+    for (i = 0; i < BTREE_ORDER; i++) {
+        above += n->keys[i] > key;
+    }
+#endif
+    /* the padding only compares equal to a BTREE_KEY_MAX key */
+    return BTREE_ORDER - above < n->count ? BTREE_ORDER - above : n->count;
+}
+
+static void btree_pad(btree_node *n) {
+    unsigned int i;
+    for (i = n->count; i < BTREE_ORDER; i++) {
+        n->keys[i] = BTREE_KEY_MAX;
+    }
+}
+
+static btree_node *btree_alloc(unsigned int leaf) {
+    btree_node *n;
+    if (posix_memalign((void **)&n, BTREE_CACHE_LINE, leaf ? sizeof(btree_leaf) : sizeof(btree_inner)) != 0) {
+        return NULL;
+    }
+    n->count = 0;
+    n->leaf = leaf;
+    btree_pad(n);
+    if (leaf) {
+        BTREE_LEAF(n)->next = NULL;
+    }
+    return n;
+}
+
+btree_t btree_create(void) {
+    btree_t t = (btree_t)malloc(sizeof(btree));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->root = btree_alloc(1);
+    if (t->root == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->count = 0;
+    t->height = 1;
+    return t;
+}
+
+static btree_leaf *btree_find_leaf(btree_t t, btree_key key) {
+    btree_node *n = t->root;
+    while (!n->leaf) {
+        n = BTREE_INNER(n)->children[btree_count_upto(n, key)];
+    }
+    return BTREE_LEAF(n);
+}
+
+void *btree_search(btree_t t, btree_key key) {
+    btree_leaf *l = btree_find_leaf(t, key);
+    unsigned int pos = btree_count_below(&l->base, key);
+    return pos < l->base.count && l->base.keys[pos] == key ? l->values[pos] : NULL;
+}
+
+/* Inserts into a full leaf by splitting it into 'l' and 'right', and
+ * returns the first key of 'right' to link it under. */
+static btree_key btree_split_leaf(btree_leaf *l, btree_leaf *right, unsigned int pos, btree_key key, void *value) {
+    btree_key keys[BTREE_ORDER + 1];
+    void *values[BTREE_ORDER + 1];
+    unsigned int half = (BTREE_ORDER + 1) / 2;
+    memcpy(keys, l->base.keys, pos * sizeof(btree_key));
+    memcpy(values, l->values, pos * sizeof(void *));
+    keys[pos] = key;
+    values[pos] = value;
+    memcpy(keys + pos + 1, l->base.keys + pos, (BTREE_ORDER - pos) * sizeof(btree_key));
+    memcpy(values + pos + 1, l->values + pos, (BTREE_ORDER - pos) * sizeof(void *));
+    memcpy(l->base.keys, keys, half * sizeof(btree_key));
+    memcpy(l->values, values, half * sizeof(void *));
+    l->base.count = half;
+    btree_pad(&l->base);
+    memcpy(right->base.keys, keys + half, (BTREE_ORDER + 1 - half) * sizeof(btree_key));
+    memcpy(right->values, values + half, (BTREE_ORDER + 1 - half) * sizeof(void *));
+    right->base.count = BTREE_ORDER + 1 - half;
+    right->next = l->next;
+    l->next = right;
+    return right->base.keys[0];
+}
+
+/* Links 'child' with separator 'key' at 'slot' of a full inner node,
+ * moving the upper half into 'right'; returns the key that moves up. */
+static btree_key btree_split_inner(btree_inner *n, btree_inner *right, unsigned int slot, btree_key key, btree_node *child) {
+    btree_key keys[BTREE_ORDER + 1];
+    btree_node *children[BTREE_ORDER + 2];
+    unsigned int half = BTREE_ORDER / 2;
+    memcpy(keys, n->base.keys, slot * sizeof(btree_key));
+    keys[slot] = key;
+    memcpy(keys + slot + 1, n->base.keys + slot, (BTREE_ORDER - slot) * sizeof(btree_key));
+    memcpy(children, n->children, (slot + 1) * sizeof(btree_node *));
+    children[slot + 1] = child;
+    memcpy(children + slot + 2, n->children + slot + 1, (BTREE_ORDER - slot) * sizeof(btree_node *));
+    memcpy(n->base.keys, keys, half * sizeof(btree_key));
+    memcpy(n->children, children, (half + 1) * sizeof(btree_node *));
+    n->base.count = half;
+    btree_pad(&n->base);
+    memcpy(right->base.keys, keys + half + 1, (BTREE_ORDER - half) * sizeof(btree_key));
+    memcpy(right->children, children + half + 1, (BTREE_ORDER - half + 1) * sizeof(btree_node *));
+    right->base.count = BTREE_ORDER - half;
+    return keys[half];
+}
+
+int btree_insert(btree_t t, btree_key key, void *value) {
+    btree_inner *path[BTREE_MAX_HEIGHT];
+    unsigned int slots[BTREE_MAX_HEIGHT];
+    btree_node *spare[BTREE_MAX_HEIGHT + 1];
+    btree_node *n = t->root, *right;
+    btree_inner *root;
+    btree_key up;
+    unsigned int depth = 0, pos, full, i;
+    while (!n->leaf) {
+        pos = btree_count_upto(n, key);
+        path[depth] = BTREE_INNER(n);
+        slots[depth++] = pos;
+        n = BTREE_INNER(n)->children[pos];
+    }
+    pos = btree_count_below(n, key);
+    if (pos < n->count && n->keys[pos] == key) {
+        return -1;
+    }
+    if (n->count < BTREE_ORDER) {
+        memmove(n->keys + pos + 1, n->keys + pos, (n->count - pos) * sizeof(btree_key));
+        memmove(BTREE_LEAF(n)->values + pos + 1, BTREE_LEAF(n)->values + pos, (n->count - pos) * sizeof(void *));
+        n->keys[pos] = key;
+        BTREE_LEAF(n)->values[pos] = value;
+        n->count++;
+        t->count++;
+        return -1;
+    }
+    /* allocate every node the split chain needs first, so running out of
+     * memory leaves the tree untouched */
+    for (full = 0; full < depth && path[depth - 1 - full]->base.count == BTREE_ORDER; full++)
+        ;
+    for (i = 0; i < 1 + full + (full == depth); i++) {
+        if ((spare[i] = btree_alloc(i == 0)) == NULL) {
+            while (i-- > 0) {
+                free(spare[i]);
+            }
+            return 0;
+        }
+    }
+    right = spare[0];
+    up = btree_split_leaf(BTREE_LEAF(n), BTREE_LEAF(right), pos, key, value);
+    for (i = 1; depth > 0; i++) {
+        n = &path[--depth]->base;
+        pos = slots[depth];
+        if (n->count < BTREE_ORDER) {
+            memmove(n->keys + pos + 1, n->keys + pos, (n->count - pos) * sizeof(btree_key));
+            memmove(BTREE_INNER(n)->children + pos + 2, BTREE_INNER(n)->children + pos + 1, (n->count - pos) * sizeof(btree_node *));
+            n->keys[pos] = up;
+            BTREE_INNER(n)->children[pos + 1] = right;
+            n->count++;
+            t->count++;
+            return -1;
+        }
+        up = btree_split_inner(BTREE_INNER(n), BTREE_INNER(spare[i]), pos, up, right);
+        right = spare[i];
+    }
+    /* the root split too */
+    root = BTREE_INNER(spare[i]);
+    root->base.keys[0] = up;
+    root->base.count = 1;
+    root->children[0] = t->root;
+    root->children[1] = right;
+    t->root = &root->base;
+    t->height++;
+    t->count++;
+    return -1;
+}
+
+/* Refills children[slot] of 'p', which is one key short, from a sibling
+ * with keys to spare or by merging it with one. */
+static void btree_rebalance(btree_inner *p, unsigned int slot) {
+    btree_node *n = p->children[slot];
+    btree_node *left = slot > 0 ? p->children[slot - 1] : NULL;
+    btree_node *right = slot < p->base.count ? p->children[slot + 1] : NULL;
+    btree_node *a, *b;
+    if (left != NULL && left->count > BTREE_MIN_KEYS) {
+        memmove(n->keys + 1, n->keys, n->count * sizeof(btree_key));
+        if (n->leaf) {
+            memmove(BTREE_LEAF(n)->values + 1, BTREE_LEAF(n)->values, n->count * sizeof(void *));
+            n->keys[0] = left->keys[left->count - 1];
+            BTREE_LEAF(n)->values[0] = BTREE_LEAF(left)->values[left->count - 1];
+            p->base.keys[slot - 1] = n->keys[0];
+        }
+        else {
+            memmove(BTREE_INNER(n)->children + 1, BTREE_INNER(n)->children, (n->count + 1) * sizeof(btree_node *));
+            n->keys[0] = p->base.keys[slot - 1];
+            BTREE_INNER(n)->children[0] = BTREE_INNER(left)->children[left->count];
+            p->base.keys[slot - 1] = left->keys[left->count - 1];
+        }
+        n->count++;
+        left->count--;
+        btree_pad(left);
+        return;
+    }
+    if (right != NULL && right->count > BTREE_MIN_KEYS) {
+        if (n->leaf) {
+            n->keys[n->count] = right->keys[0];
+            BTREE_LEAF(n)->values[n->count] = BTREE_LEAF(right)->values[0];
+            memmove(BTREE_LEAF(right)->values, BTREE_LEAF(right)->values + 1, (right->count - 1) * sizeof(void *));
+            memmove(right->keys, right->keys + 1, (right->count - 1) * sizeof(btree_key));
+            p->base.keys[slot] = right->keys[0];
+        }
+        else {
+            n->keys[n->count] = p->base.keys[slot];
+            BTREE_INNER(n)->children[n->count + 1] = BTREE_INNER(right)->children[0];
+            p->base.keys[slot] = right->keys[0];
+            memmove(BTREE_INNER(right)->children, BTREE_INNER(right)->children + 1, right->count * sizeof(btree_node *));
+            memmove(right->keys, right->keys + 1, (right->count - 1) * sizeof(btree_key));
+        }
+        n->count++;
+        right->count--;
+        btree_pad(right);
+        return;
+    }
+    /* merge b into a and drop the separator between them */
+    if (left != NULL) {
+        a = left;
+        b = n;
+        slot--;
+    }
+    else {
+        a = n;
+        b = right;
+    }
+    if (a->leaf) {
+        memcpy(a->keys + a->count, b->keys, b->count * sizeof(btree_key));
+        memcpy(BTREE_LEAF(a)->values + a->count, BTREE_LEAF(b)->values, b->count * sizeof(void *));
+        a->count += b->count;
+        BTREE_LEAF(a)->next = BTREE_LEAF(b)->next;
+    }
+    else {
+        a->keys[a->count] = p->base.keys[slot];
+        memcpy(a->keys + a->count + 1, b->keys, b->count * sizeof(btree_key));
+        memcpy(BTREE_INNER(a)->children + a->count + 1, BTREE_INNER(b)->children, (b->count + 1) * sizeof(btree_node *));
+        a->count += b->count + 1;
+    }
+    free(b);
+    memmove(p->base.keys + slot, p->base.keys + slot + 1, (p->base.count - slot - 1) * sizeof(btree_key));
+    memmove(p->children + slot + 1, p->children + slot + 2, (p->base.count - slot - 1) * sizeof(btree_node *));
+    p->base.count--;
+    btree_pad(&p->base);
+}
+
+int btree_remove(btree_t t, btree_key key) {
+    btree_inner *path[BTREE_MAX_HEIGHT];
+    unsigned int slots[BTREE_MAX_HEIGHT];
+    btree_node *n = t->root;
+    unsigned int depth = 0, pos;
+    while (!n->leaf) {
+        pos = btree_count_upto(n, key);
+        path[depth] = BTREE_INNER(n);
+        slots[depth++] = pos;
+        n = BTREE_INNER(n)->children[pos];
+    }
+    pos = btree_count_below(n, key);
+    if (pos >= n->count || n->keys[pos] != key) {
+        return -1;
+    }
+    memmove(n->keys + pos, n->keys + pos + 1, (n->count - pos - 1) * sizeof(btree_key));
+    memmove(BTREE_LEAF(n)->values + pos, BTREE_LEAF(n)->values + pos + 1, (n->count - pos - 1) * sizeof(void *));
+    n->count--;
+    n->keys[n->count] = BTREE_KEY_MAX;
+    t->count--;
+    /* separators may name removed keys, they only have to keep ordering */
+    while (depth > 0 && n->count < BTREE_MIN_KEYS) {
+        depth--;
+        btree_rebalance(path[depth], slots[depth]);
+        n = &path[depth]->base;
+    }
+    if (!t->root->leaf && t->root->count == 0) {
+        n = t->root;
+        t->root = BTREE_INNER(n)->children[0];
+        t->height--;
+        free(n);
+    }
+    return -1;
+}
+
+unsigned int btree_count(btree_t t) {
+    return t->count;
+}
+
+unsigned int btree_range(btree_t t, btree_key lo, btree_key hi, void (*fn)(void *ctx, btree_key key, void *value), void *ctx) {
+    btree_leaf *l = btree_find_leaf(t, lo);
+    unsigned int pos = btree_count_below(&l->base, lo), count = 0;
+    for (; l != NULL; l = l->next, pos = 0) {
+        for (; pos < l->base.count; pos++) {
+            if (l->base.keys[pos] >= hi) {
+                return count;
+            }
+            fn(ctx, l->base.keys[pos], l->values[pos]);
+            count++;
+        }
+    }
+    return count;
+}
+
+static void btree_free_nodes(btree_node *n) {
+    unsigned int i;
+    if (!n->leaf) {
+        for (i = 0; i <= n->count; i++) {
+            btree_free_nodes(BTREE_INNER(n)->children[i]);
+        }
+    }
+    free(n);
+}
+
+void btree_destroy(btree_t t) {
+    btree_free_nodes(t->root);
+    free(t);
+}
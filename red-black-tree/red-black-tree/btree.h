@@ -0,0 +1,78 @@
+//
+//  btree.h
+//  red-black-tree
+//
+//  B+-tree over integer keys, an alternative to rbtree for large ordered
+//  sets. Every node keeps its keys in one contiguous, cache line aligned
+//  array of BTREE_ORDER slots (two lines), searched by counting with SIMD
+//  compares instead of branching, so a lookup costs about log16(n) node
+//  visits instead of log2(n) pointer hops. Values live in the leaves,
+//  which are chained in key order for range scans.
+//
+//  The calls mirror rbtree.h, but keys are btree_key integers: a SIMD
+//  search has to know the key type, so there is no cmp_func.
+//
+//  The compares use AVX2 when built with -mavx2, SSE4.2 with -msse4.2,
+//  and otherwise SSE2, which every x86-64 CPU has. The Xcode project sets
+//  no -m flags, so its builds take the SSE2 path; SSE2 has no 64 bit
+//  compare, and -msse4.2 about halves the cost of a node search. Other
+//  architectures fall back to a branch-free scalar count.
+//
+
+#ifndef red_black_tree_btree_h
+#define red_black_tree_btree_h
+
+#include <limits.h>
+
+#define BTREE_ORDER         16              /* keys per node */
+#define BTREE_MIN_KEYS      (BTREE_ORDER / 2)
+#define BTREE_CACHE_LINE    64
+#define BTREE_MAX_HEIGHT    32
+
+typedef long long btree_key;
+
+/* pads the unused key slots, so a search can always scan all of them */
+#define BTREE_KEY_MAX       LLONG_MAX
+
+/* Nodes are allocated on a cache line, so 'keys' covers exactly two lines;
+ * the header is not padded out so children and values follow directly. */
+typedef struct btree_node {
+    btree_key keys[BTREE_ORDER];    /* sorted, BTREE_KEY_MAX past 'count' */
+    unsigned int count;
+    unsigned int leaf;
+} btree_node;
+
+/* children[i] holds the keys below keys[i], children[count] the rest */
+typedef struct {
+    btree_node base;
+    btree_node *children[BTREE_ORDER + 1];
+} btree_inner;
+
+typedef struct btree_leaf {
+    btree_node base;
+    void *values[BTREE_ORDER];
+    struct btree_leaf *next;
+} btree_leaf;
+
+typedef struct {
+    btree_node *root;
+    unsigned int count;
+    unsigned int height;            /* 1 while the root is a leaf */
+} btree;
+
+typedef btree *btree_t;
+
+btree_t btree_create(void);
+/* the value stored under 'key', or NULL */
+void *btree_search(btree_t t, btree_key key);
+/* -1 when inserted or already present (the old value stays), 0 on OOM */
+int btree_insert(btree_t t, btree_key key, void *value);
+/* -1 when removed or absent */
+int btree_remove(btree_t t, btree_key key);
+unsigned int btree_count(btree_t t);
+/* calls fn(ctx, key, value) for each key in [lo, hi) in order, returns how many */
+unsigned int btree_range(btree_t t, btree_key lo, btree_key hi, void (*fn)(void *ctx, btree_key key, void *value), void *ctx);
+/* frees the tree and its nodes, not the values */
+void btree_destroy(btree_t t);
+
+#endif
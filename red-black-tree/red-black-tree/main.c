@@ -7,12 +7,502 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rbtree.h"
+#include "rbtree_concurrent.h"
+#include "btree.h"
+#include "../../common/bench.h"
+
+#define DEFAULT_KEY_COUNT   1000000
+
+typedef struct {
+    int key;
+    rbtree_node node;
+} int_item;
+
+typedef struct {
+    rbtree_t t;                     /* with 'lock', or */
+    pthread_mutex_t *lock;
+    crbtree *c;                     /* lock-free readers, one writer lock */
+    int *keys;
+    unsigned int keycount;
+    unsigned int ops;
+    unsigned int search_percent;
+    unsigned int seed;
+} threadargs;
+
+int item_cmp(rbtree_node_t left, rbtree_node_t right);
+int item_key_cmp(void *key, rbtree_node_t node);
+void *scaling_create(void);
+void scaling_insert(void *t, void *key);
+void scaling_search(void *t, void *key);
+void scaling_remove(void *t, void *key);
+int scaling_verify(void *t);
+void scaling_destroy(void *t);
+void bench_modes(unsigned int count);
+void count_value(void *ctx, void *value);
+void bench_order(unsigned int count);
+void bench_bulk(unsigned int count);
+void *threads_worker(void *args);
+void bench_threads(unsigned int count);
+void bench_churn(unsigned int count);
+void count_key(void *ctx, btree_key key, void *value);
+void bench_btree(unsigned int count);
+
+int item_cmp(rbtree_node_t left, rbtree_node_t right) {
+    return bench_int_cmp(&rbtree_entry(left, int_item, node)->key, &rbtree_entry(right, int_item, node)->key);
+}
+
+int item_key_cmp(void *key, rbtree_node_t node) {
+    return bench_int_cmp(key, &rbtree_entry(node, int_item, node)->key);
+}
+
+void *scaling_create(void) {
+    return rbtree_create();
+}
+
+void scaling_insert(void *t, void *key) {
+    rbtree_insert((rbtree_t)t, key, bench_int_cmp);
+}
+
+void scaling_search(void *t, void *key) {
+    rbtree_search((rbtree_t)t, key, bench_int_cmp);
+}
+
+void scaling_remove(void *t, void *key) {
+    rbtree_remove((rbtree_t)t, key, bench_int_cmp);
+}
+
+int scaling_verify(void *t) {
+    return rbtree_verify_properties((rbtree_t)t);
+}
+
+void scaling_destroy(void *t) {
+    rbtree_destroy((rbtree_t)t);
+}
+
+/* malloc'd nodes, the default bench_modes compares the pool against */
+const bench_scaling_ops scaling_ops = {
+    "search", "remove",
+    scaling_create, scaling_insert, scaling_search, scaling_remove, scaling_verify, scaling_destroy
+};
+
+/* malloc'd nodes against pooled ones and nodes embedded in the items */
+void bench_modes(unsigned int count) {
+    const char *names[] = { "malloc", "pool" };
+    unsigned int flags[] = { RBTREE_MALLOC, RBTREE_POOL };
+    unsigned int round, i;
+    int *keys = bench_keys(count, BENCH_KEY_SEED);
+    int_item *items = (int_item *)malloc(sizeof(int_item) * count);
+    rbtree_t t;
+    double start, insert_ns, search_ns, remove_ns;
+
+    if (keys == NULL || items == NULL) {
+        free(keys);
+        free(items);
+        return;
+    }
+    for (round = 0; round < 2; round++) {
+        if ((t = rbtree_create_with_flags(flags[round])) == NULL) {
+            break;
+        }
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            rbtree_insert(t, &keys[i], bench_int_cmp);
+        }
+        insert_ns = (bench_now_ns() - start) / count;
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            rbtree_search(t, &keys[(i * 7919u) % count], bench_int_cmp);
+        }
+        search_ns = (bench_now_ns() - start) / count;
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            rbtree_remove(t, &keys[i], bench_int_cmp);
+        }
+        remove_ns = (bench_now_ns() - start) / count;
+        printf("%-10s %10u keys  insert %7.1f  search %7.1f  remove %7.1f ns/op\n",
+               names[round], count, insert_ns, search_ns, remove_ns);
+        rbtree_destroy(t);
+    }
+
+    if ((t = rbtree_create_with_flags(RBTREE_INTRUSIVE)) != NULL) {
+        for (i = 0; i < count; i++) {
+            items[i].key = keys[i];
+        }
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            rbtree_insert_node(t, &items[i].node, item_cmp);
+        }
+        insert_ns = (bench_now_ns() - start) / count;
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            rbtree_search_node(t, &keys[(i * 7919u) % count], item_key_cmp);
+        }
+        search_ns = (bench_now_ns() - start) / count;
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            rbtree_remove_node(t, rbtree_search_node(t, &keys[i], item_key_cmp));
+        }
+        remove_ns = (bench_now_ns() - start) / count;
+        printf("%-10s %10u keys  insert %7.1f  search %7.1f  remove %7.1f ns/op\n",
+               "intrusive", count, insert_ns, search_ns, remove_ns);
+        rbtree_destroy(t);
+    }
+    free(keys);
+    free(items);
+}
+
+void count_value(void *ctx, void *value) {
+    *(unsigned long long *)ctx += *(int *)value;
+}
+
+/* rank, select and short range scans on one tree of 'count' keys */
+void bench_order(unsigned int count) {
+    int *keys = bench_keys(count, BENCH_KEY_SEED);
+    rbtree_t t = rbtree_create();
+    unsigned int i, span = 100, ranks = 0, scanned = 0;
+    unsigned long long sum = 0;
+    int hi;
+    double start, rank_ns, select_ns, range_ns;
+
+    if (keys == NULL || t == NULL) {
+        free(keys);
+        if (t != NULL) rbtree_destroy(t);
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        rbtree_insert(t, &keys[i], bench_int_cmp);
+    }
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        ranks += rbtree_rank(t, &keys[i], bench_int_cmp) == (unsigned int)keys[i];
+    }
+    rank_ns = (bench_now_ns() - start) / count;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        ranks += *(int *)rbtree_select(t, (unsigned int)keys[i])->value == keys[i];
+    }
+    select_ns = (bench_now_ns() - start) / count;
+    /* [key, key + span) from every key, so about 'span' values per scan */
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hi = keys[i] + (int)span;
+        scanned += rbtree_range(t, &keys[i], &hi, bench_int_cmp, count_value, &sum);
+    }
+    range_ns = (bench_now_ns() - start) / (scanned ? scanned : 1);
+
+    printf("order      %10u keys  rank %7.1f  select %7.1f ns/op  range %5.1f ns/value  (%u/%u exact, checksum %llu)\n",
+           count, rank_ns, select_ns, range_ns, ranks, count * 2, sum);
+    rbtree_destroy(t);
+    free(keys);
+}
+
+/* building from sorted input and merging two halves, against inserting */
+void bench_bulk(unsigned int count) {
+    int *sorted = (int *)malloc(sizeof(int) * count);
+    void **values = (void **)malloc(sizeof(void *) * count);
+    unsigned int i, half = count / 2;
+    rbtree_t t, other;
+    double start, insert_ms, load_ms, merge_ms, union_ms;
+
+    if (sorted == NULL || values == NULL) {
+        free(sorted);
+        free(values);
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        sorted[i] = (int)i;
+        values[i] = &sorted[i];
+    }
+
+    if ((t = rbtree_create()) == NULL) goto out;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        rbtree_insert(t, values[i], bench_int_cmp);
+    }
+    insert_ms = (bench_now_ns() - start) / 1e6;
+    rbtree_destroy(t);
+
+    if ((t = rbtree_create()) == NULL) goto out;
+    start = bench_now_ns();
+    rbtree_load_sorted(t, values, count);
+    load_ms = (bench_now_ns() - start) / 1e6;
+    rbtree_destroy(t);
+
+    /* two interleaved halves, evens and odds */
+    for (i = 0; i < half; i++) {
+        values[i] = &sorted[2 * i];
+        values[half + i] = &sorted[2 * i + 1];
+    }
+    if ((t = rbtree_create()) == NULL) goto out;
+    rbtree_load_sorted(t, values, half);
+    start = bench_now_ns();
+    for (i = half; i < 2 * half; i++) {
+        rbtree_insert(t, values[i], bench_int_cmp);
+    }
+    merge_ms = (bench_now_ns() - start) / 1e6;
+    rbtree_destroy(t);
+
+    if ((t = rbtree_create()) == NULL) goto out;
+    if ((other = rbtree_create()) == NULL) {
+        rbtree_destroy(t);
+        goto out;
+    }
+    rbtree_load_sorted(t, values, half);
+    rbtree_load_sorted(other, values + half, half);
+    start = bench_now_ns();
+    rbtree_union(t, other, bench_int_cmp);
+    union_ms = (bench_now_ns() - start) / 1e6;
+    printf("bulk       %10u keys  insert sorted %8.1f ms  load_sorted %8.1f ms  insert half %8.1f ms  union %8.1f ms%s\n",
+           count, insert_ms, load_ms, merge_ms, union_ms,
+           rbtree_count(t) == 2 * half && rbtree_verify_properties(t) ? "" : "  INVALID");
+    rbtree_destroy(t);
+    rbtree_destroy(other);
+out:
+    free(sorted);
+    free(values);
+}
+
+void *threads_worker(void *args) {
+    threadargs *a = (threadargs *)args;
+    unsigned int x = a->seed, i;
+    int *key;
+    for (i = 0; i < a->ops; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        key = &a->keys[x % a->keycount];
+        if (x % 100 < a->search_percent) {
+            if (a->c != NULL) {
+                crbtree_search(a->c, key);
+            }
+            else {
+                pthread_mutex_lock(a->lock);
+                rbtree_search(a->t, key, bench_int_cmp);
+                pthread_mutex_unlock(a->lock);
+            }
+        }
+        else {
+            // take the key out and put it back, so the tree keeps its size
+            if (a->c != NULL) {
+                crbtree_remove(a->c, key);
+                crbtree_insert(a->c, key);
+            }
+            else {
+                pthread_mutex_lock(a->lock);
+                rbtree_remove(a->t, key, bench_int_cmp);
+                rbtree_insert(a->t, key, bench_int_cmp);
+                pthread_mutex_unlock(a->lock);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* 1..16 threads sharing 'count' operations on a tree of 'count' keys:
+ * one global mutex around an rbtree versus the concurrent tree */
+void bench_threads(unsigned int count) {
+    unsigned int search_percents[] = { 99, 90 };
+    unsigned int threadcounts[] = { 1, 2, 4, 8, 16 };
+    pthread_t threads[16];
+    threadargs args[16];
+    pthread_mutex_t lock;
+    int *keys = bench_keys(count, BENCH_KEY_SEED);
+    rbtree_t t = rbtree_create();
+    crbtree *c = crbtree_create(bench_int_cmp, NULL);
+    unsigned int i, s, n, variant, idx;
+    double start;
+    if (keys == NULL || t == NULL || c == NULL) {
+        free(keys);
+        if (t != NULL) rbtree_destroy(t);
+        if (c != NULL) crbtree_destroy(c);
+        return;
+    }
+    pthread_mutex_init(&lock, NULL);
+    for (i = 0; i < count; i++) {
+        rbtree_insert(t, &keys[i], bench_int_cmp);
+        crbtree_insert(c, &keys[i]);
+    }
+    for (s = 0; s < sizeof(search_percents) / sizeof(search_percents[0]); s++) {
+        for (idx = 0; idx < sizeof(threadcounts) / sizeof(threadcounts[0]); idx++) {
+            for (variant = 0; variant < 2; variant++) {
+                n = threadcounts[idx];
+                for (i = 0; i < n; i++) {
+                    args[i].t = t;
+                    args[i].lock = &lock;
+                    args[i].c = variant == 1 ? c : NULL;
+                    args[i].keys = keys;
+                    args[i].keycount = count;
+                    args[i].ops = count / n;
+                    args[i].search_percent = search_percents[s];
+                    args[i].seed = 2463534242u + i * 7919u;
+                }
+                start = bench_now_ns();
+                for (i = 0; i < n; i++) {
+                    pthread_create(&threads[i], NULL, threads_worker, &args[i]);
+                }
+                for (i = 0; i < n; i++) {
+                    pthread_join(threads[i], NULL);
+                }
+                printf("%-12s %3u%% search %2u threads  %12.0f ops/s\n",
+                       variant == 1 ? "concurrent" : "mutex", search_percents[s], n,
+                       (count / n) * n / ((bench_now_ns() - start) / 1e9));
+            }
+        }
+    }
+    pthread_mutex_destroy(&lock);
+    rbtree_destroy(t);
+    crbtree_destroy(c);
+    free(keys);
+}
+
+/* Removes and reinserts random nodes of a small intrusive tree: nothing
+ * is allocated and the tree stays in cache, so this is mostly the
+ * rebalancing itself. */
+void bench_churn(unsigned int count) {
+    unsigned int size = count < 1024 ? count : 1024;
+    int *keys = bench_keys(size, BENCH_KEY_SEED);
+    int_item *items = (int_item *)malloc(sizeof(int_item) * size);
+    rbtree_t t = rbtree_create_with_flags(RBTREE_INTRUSIVE);
+    unsigned int i, x = 2463534242u;
+    int_item *item;
+    double start;
+    if (keys == NULL || items == NULL || t == NULL) {
+        free(keys);
+        free(items);
+        if (t != NULL) rbtree_destroy(t);
+        return;
+    }
+    for (i = 0; i < size; i++) {
+        items[i].key = keys[i];
+        rbtree_insert_node(t, &items[i].node, item_cmp);
+    }
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        item = &items[x % size];
+        rbtree_remove_node(t, &item->node);
+        rbtree_insert_node(t, &item->node, item_cmp);
+    }
+    printf("churn      %10u nodes %10u remove+insert  %7.1f ns/pair%s\n",
+           size, count, (bench_now_ns() - start) / count, rbtree_verify_properties(t) ? "" : "  INVALID");
+    rbtree_destroy(t);
+    free(keys);
+    free(items);
+}
+
+void count_key(void *ctx, btree_key key, void *value) {
+    *(unsigned long long *)ctx += *(int *)value;
+}
+
+/* the same random keys through the pool rbtree and the B+-tree */
+void bench_btree(unsigned int count) {
+    int *keys = bench_keys(count, BENCH_KEY_SEED);
+    rbtree_t t = rbtree_create_with_flags(RBTREE_POOL);
+    btree_t b = btree_create();
+    unsigned int i, span = 100, scanned;
+    unsigned long long sum;
+    int hi;
+    double start, insert_ns, search_ns, range_ns, remove_ns;
+
+    if (keys == NULL || t == NULL || b == NULL) {
+        free(keys);
+        if (t != NULL) rbtree_destroy(t);
+        if (b != NULL) btree_destroy(b);
+        return;
+    }
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        rbtree_insert(t, &keys[i], bench_int_cmp);
+    }
+    insert_ns = (bench_now_ns() - start) / count;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        rbtree_search(t, &keys[(i * 7919u) % count], bench_int_cmp);
+    }
+    search_ns = (bench_now_ns() - start) / count;
+    sum = 0;
+    scanned = 0;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hi = keys[i] + (int)span;
+        scanned += rbtree_range(t, &keys[i], &hi, bench_int_cmp, count_value, &sum);
+    }
+    range_ns = (bench_now_ns() - start) / (scanned ? scanned : 1);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        rbtree_remove(t, &keys[i], bench_int_cmp);
+    }
+    remove_ns = (bench_now_ns() - start) / count;
+    printf("rbtree     %10u keys  insert %7.1f  search %7.1f  remove %7.1f ns/op  range %5.1f ns/value  (checksum %llu)\n",
+           count, insert_ns, search_ns, remove_ns, range_ns, sum);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        btree_insert(b, keys[i], &keys[i]);
+    }
+    insert_ns = (bench_now_ns() - start) / count;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        btree_search(b, keys[(i * 7919u) % count]);
+    }
+    search_ns = (bench_now_ns() - start) / count;
+    sum = 0;
+    scanned = 0;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        scanned += btree_range(b, keys[i], (btree_key)keys[i] + span, count_key, &sum);
+    }
+    range_ns = (bench_now_ns() - start) / (scanned ? scanned : 1);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        btree_remove(b, keys[i]);
+    }
+    remove_ns = (bench_now_ns() - start) / count;
+    printf("btree      %10u keys  insert %7.1f  search %7.1f  remove %7.1f ns/op  range %5.1f ns/value  (checksum %llu)\n",
+           count, insert_ns, search_ns, remove_ns, range_ns, sum);
+
+    rbtree_destroy(t);
+    btree_destroy(b);
+    free(keys);
+}
 
 int main (int argc, const char * argv[])
 {
+    const char *bench = argc > 1 ? argv[1] : "all";
+    unsigned int count = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : DEFAULT_KEY_COUNT;
+    int all = strcmp(bench, "all") == 0;
+    if (count == 0) {
+        fprintf(stderr, "usage: red-black-tree [all|scaling|modes|order|bulk|threads|churn|btree] [keys]\n");
+        return 1;
+    }
 
-    // insert test/implementation code here...
     printf("Red Black Tree!\n");
+    if (all || strcmp(bench, "scaling") == 0) {
+        bench_scaling(&scaling_ops, count);
+    }
+    if (all || strcmp(bench, "modes") == 0) {
+        bench_modes(count);
+    }
+    if (all || strcmp(bench, "order") == 0) {
+        bench_order(count);
+    }
+    if (all || strcmp(bench, "bulk") == 0) {
+        bench_bulk(count);
+    }
+    if (all || strcmp(bench, "threads") == 0) {
+        bench_threads(count);
+    }
+    if (all || strcmp(bench, "churn") == 0) {
+        bench_churn(count);
+    }
+    if (all || strcmp(bench, "btree") == 0) {
+        bench_btree(count);
+    }
     return 0;
 }
-
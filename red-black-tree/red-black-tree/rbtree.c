@@ -13,43 +13,78 @@
 #include <stdlib.h>
 #include "rbtree.h"
 
+#define RBTREE_POOL_MIN_BLOCK   64
+#define RBTREE_POOL_MAX_BLOCK   4096
+
 rbtree_t rbtree_create() {
+    return rbtree_create_with_flags(RBTREE_MALLOC);
+}
+
+rbtree_t rbtree_create_with_flags(unsigned int flags) {
     rbtree_t t = (rbtree_t)malloc(sizeof(rbtree));
     if (t == NULL) {
         return NULL;
     }
     t->root = NULL;
+    t->flags = flags;
+    t->blocks = NULL;
+    t->freelist = NULL;
+    t->cursor = 0;
+    t->version = 0;
     return t;
 }
 
 rbtree_node_t rbtree_grandparent(rbtree_node_t n) {
-    if (n == NULL || n->parent == NULL) {
+    if (n == NULL || rbtree_parent(n) == NULL) {
         return NULL;
     }
-    return n->parent->parent;
+    return rbtree_parent(rbtree_parent(n));
 }
 
 rbtree_node_t rbtree_sibling(rbtree_node_t n) {
-    if (n == NULL || n->parent == NULL) {
+    if (n == NULL || rbtree_parent(n) == NULL) {
         return NULL;
     }
-    if (n == n->parent->left) {
-        return n->parent->right;
+    if (n == rbtree_parent(n)->left) {
+        return rbtree_parent(n)->right;
     }
     else {
-        return n->parent->left;
+        return rbtree_parent(n)->left;
     }
 }
 
 rbtree_node_t rbtree_uncle(rbtree_node_t n) {
-    if (n == NULL || n->parent == NULL) {
+    if (n == NULL || rbtree_parent(n) == NULL) {
         return NULL;
     }
-    return rbtree_sibling(n->parent);
+    return rbtree_sibling(rbtree_parent(n));
 }
 
 rbtree_node_color rbtree_get_node_color(rbtree_node_t n) {
-    return n == NULL ? BLACK : n->color;
+    return n == NULL ? BLACK : rbtree_color(n);
+}
+
+unsigned int rbtree_get_node_size(rbtree_node_t n) {
+    return n == NULL ? 0 : n->size;
+}
+
+/* Links that crbtree's lock free readers load (root, left, right and
+ * parent_color) are stored atomically. Relaxed is enough: a store that
+ * moves a reachable node sits between version_begin and version_end,
+ * which order it for readers that validate the version. */
+#define RBTREE_STORE(field, v)  __atomic_store_n(&(field), (v), __ATOMIC_RELAXED)
+
+/* nodes are at least 4 byte aligned, so bit 0 of the parent pointer is free */
+static inline void set_parent_color(rbtree_node_t n, rbtree_node_t parent, rbtree_node_color color) {
+    RBTREE_STORE(n->parent_color, (unsigned long)parent | color);
+}
+
+static inline void set_parent(rbtree_node_t n, rbtree_node_t parent) {
+    RBTREE_STORE(n->parent_color, (unsigned long)parent | (n->parent_color & RBTREE_COLOR_MASK));
+}
+
+static inline void set_color(rbtree_node_t n, rbtree_node_color color) {
+    RBTREE_STORE(n->parent_color, (n->parent_color & ~RBTREE_COLOR_MASK) | color);
 }
 
 int property_check_1(rbtree_node_t n);
@@ -57,7 +92,7 @@ int property_check_1(rbtree_node_t n) {
     if (n == NULL) {
         return -1;
     }
-    if (n->color != RED && n->color != BLACK) {
+    if (rbtree_color(n) != RED && rbtree_color(n) != BLACK) {
         return 0;
     }
     if (property_check_1(n->left) == 0) {
@@ -71,10 +106,11 @@ int property_check_1(rbtree_node_t n) {
 
 int property_check_4(rbtree_node_t n);
 int property_check_4(rbtree_node_t n) {
+    /* every red node has black children (and so a black parent) */
     if (rbtree_get_node_color(n) == RED) {
-        if (rbtree_get_node_color(n->left) == BLACK ||
-            rbtree_get_node_color(n->right) == BLACK ||
-            rbtree_get_node_color(n->parent) == BLACK) {
+        if (rbtree_get_node_color(n->left) == RED ||
+            rbtree_get_node_color(n->right) == RED ||
+            rbtree_get_node_color(rbtree_parent(n)) == RED) {
             return 0;
         }
     }
@@ -135,23 +171,60 @@ int rbtree_verify_properties(rbtree_t t) {
     return -1;
 }
 
-rbtree_node_t new_node(void *value, rbtree_node_color color, rbtree_node_t left, rbtree_node_t right);
-rbtree_node_t new_node(void *value, rbtree_node_color color, rbtree_node_t left, rbtree_node_t right) {
-    rbtree_node_t n = (rbtree_node_t)malloc(sizeof(rbtree_node));
+/* nodes of a block sit right after its header */
+static rbtree_node_t pool_alloc(rbtree_t t) {
+    rbtree_block *b;
+    unsigned int count;
+    rbtree_node_t n = t->freelist;
+    if (n != NULL) {
+        t->freelist = n->right;
+        return n;
+    }
+    if (t->blocks == NULL || t->cursor == t->blocks->count) {
+        /* blocks double up to a cap, so small trees stay small */
+        count = t->blocks == NULL ? RBTREE_POOL_MIN_BLOCK : t->blocks->count * 2;
+        if (count > RBTREE_POOL_MAX_BLOCK) {
+            count = RBTREE_POOL_MAX_BLOCK;
+        }
+        b = (rbtree_block *)malloc(sizeof(rbtree_block) + count * sizeof(rbtree_node));
+        if (b == NULL) {
+            return NULL;
+        }
+        b->next = t->blocks;
+        b->count = count;
+        t->blocks = b;
+        t->cursor = 0;
+    }
+    return (rbtree_node_t)(t->blocks + 1) + t->cursor++;
+}
+
+static void free_node(rbtree_t t, rbtree_node_t n) {
+    if (t->flags & RBTREE_POOL) {
+        n->right = t->freelist;
+        t->freelist = n;
+    }
+    else {
+        free(n);
+    }
+}
+
+rbtree_node_t new_node(rbtree_t t, void *value, rbtree_node_color color, rbtree_node_t left, rbtree_node_t right);
+rbtree_node_t new_node(rbtree_t t, void *value, rbtree_node_color color, rbtree_node_t left, rbtree_node_t right) {
+    rbtree_node_t n = (t->flags & RBTREE_POOL) ? pool_alloc(t) : (rbtree_node_t)malloc(sizeof(rbtree_node));
     if (n == NULL) {
         return NULL;
     }
     n->value = value;
-    n->color = color;
     n->left = left;
     n->right = right;
     if (left != NULL) {
-        left->parent = n;
+        set_parent(left, n);
     }
     if (right != NULL) {
-        right->parent = n;
+        set_parent(right, n);
     }
-    n->parent = NULL;
+    set_parent_color(n, NULL, color);
+    n->size = 1 + rbtree_get_node_size(left) + rbtree_get_node_size(right);
     return n;
 }
 
@@ -179,270 +252,737 @@ void *rbtree_search(rbtree_t t, void *value, cmp_func compare) {
 }
 
 rbtree_node_t rbtree_maximum_node(rbtree_node_t n) {
-    while (n != NULL) {
+    while (n != NULL && n->right != NULL) {
         n = n->right;
     }
     return n;
 }
 
 void rbtree_replace_node(rbtree_t t, rbtree_node_t oldn, rbtree_node_t newn) {
+    rbtree_node_t parent;
     if (oldn == NULL) {
         return;
     }
-    if (oldn->parent == NULL) {
-        t->root = newn;
+    parent = rbtree_parent(oldn);
+    if (parent == NULL) {
+        RBTREE_STORE(t->root, newn);
     }
     else {
-        if (oldn == oldn->parent->left) {
-            oldn->parent->left = newn;
+        if (oldn == parent->left) {
+            RBTREE_STORE(parent->left, newn);
         }
         else {
-            oldn->parent->right = newn;
+            RBTREE_STORE(parent->right, newn);
         }
     }
     if (newn != NULL) {
-        newn->parent = oldn->parent;
+        set_parent(newn, parent);
     }
 }
 
+/* Seqlock style: 'version' is odd while nodes are being moved, so a lock
+ * free reader that saw the same even version before and after a walk
+ * knows no rotation happened underneath it. */
+static void version_begin(rbtree_t t) {
+    __atomic_store_n(&t->version, t->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void version_end(rbtree_t t) {
+    __atomic_store_n(&t->version, t->version + 1, __ATOMIC_RELEASE);
+}
+
 void rotate_left(rbtree_t t, rbtree_node_t n);
 void rotate_left(rbtree_t t, rbtree_node_t n) {
     rbtree_node_t r = n->right;
+    version_begin(t);
     rbtree_replace_node(t, n, r);
-    n->right = r->left;
+    RBTREE_STORE(n->right, r->left);
     if (r->left != NULL) {
-        r->left->parent = n;
+        set_parent(r->left, n);
     }
-    r->left = n;
-    n->parent = r;
+    RBTREE_STORE(r->left, n);
+    set_parent(n, r);
+    r->size = n->size;
+    n->size = 1 + rbtree_get_node_size(n->left) + rbtree_get_node_size(n->right);
+    version_end(t);
 }
 
 void rotate_right(rbtree_t t, rbtree_node_t n);
 void rotate_right(rbtree_t t, rbtree_node_t n) {
     rbtree_node_t l = n->left;
+    version_begin(t);
     rbtree_replace_node(t, n, l);
-    n->left = l->right;
+    RBTREE_STORE(n->left, l->right);
     if (l->right != NULL) {
-        l->right->parent = n;
+        set_parent(l->right, n);
     }
-    l->right = n;
-    n->parent = l;
+    RBTREE_STORE(l->right, n);
+    set_parent(n, l);
+    l->size = n->size;
+    n->size = 1 + rbtree_get_node_size(n->left) + rbtree_get_node_size(n->right);
+    version_end(t);
 }
 
-void insert_case1(rbtree_t t, rbtree_node_t n);
-void insert_case2(rbtree_t t, rbtree_node_t n);
-void insert_case3(rbtree_t t, rbtree_node_t n);
-void insert_case4(rbtree_t t, rbtree_node_t n);
-void insert_case5(rbtree_t t, rbtree_node_t n);
+/* Restores the red-black properties after 'n' was linked in red: while
+ * its parent is red too, either push the red up through a red uncle or
+ * fix it for good with one or two rotations at the grandparent. */
+static void insert_fixup(rbtree_t t, rbtree_node_t n) {
+    rbtree_node_t parent, gparent, uncle;
+    while ((parent = rbtree_parent(n)) != NULL && rbtree_color(parent) == RED) {
+        /* a red parent is never the root, so there is a grandparent */
+        gparent = rbtree_parent(parent);
+        if (parent == gparent->left) {
+            uncle = gparent->right;
+            if (uncle != NULL && rbtree_color(uncle) == RED) {
+                set_color(uncle, BLACK);
+                set_color(parent, BLACK);
+                set_color(gparent, RED);
+                n = gparent;
+                continue;
+            }
+            if (n == parent->right) {
+                rotate_left(t, parent);
+                parent = n;
+            }
+            set_color(parent, BLACK);
+            set_color(gparent, RED);
+            rotate_right(t, gparent);
+        }
+        else {
+            uncle = gparent->left;
+            if (uncle != NULL && rbtree_color(uncle) == RED) {
+                set_color(uncle, BLACK);
+                set_color(parent, BLACK);
+                set_color(gparent, RED);
+                n = gparent;
+                continue;
+            }
+            if (n == parent->left) {
+                rotate_right(t, parent);
+                parent = n;
+            }
+            set_color(parent, BLACK);
+            set_color(gparent, RED);
+            rotate_left(t, gparent);
+        }
+        break;
+    }
+    set_color(t->root, BLACK);
+}
 
-void insert_case5(rbtree_t t, rbtree_node_t n) {
-    n->parent->color = BLACK;
-    rbtree_grandparent(n)->color = RED;
-    if (n == n->parent->left && n->parent == rbtree_grandparent(n)->left) {
-        rotate_right(t, rbtree_grandparent(n));
-    } else if(n == n->parent->right && n->parent == rbtree_grandparent(n)->right) {
-        rotate_left(t, rbtree_grandparent(n));
+/* hangs 'node' under 'parent' (the root when NULL) and rebalances */
+static void link_node(rbtree_t t, rbtree_node_t node, rbtree_node_t parent, int left) {
+    set_parent_color(node, parent, RED);
+    node->left = NULL;
+    node->right = NULL;
+    node->size = 1;
+    /* publish a fully built node to lock free readers */
+    if (parent == NULL) {
+        __atomic_store_n(&t->root, node, __ATOMIC_RELEASE);
+    }
+    else if (left) {
+        __atomic_store_n(&parent->left, node, __ATOMIC_RELEASE);
+    }
+    else {
+        __atomic_store_n(&parent->right, node, __ATOMIC_RELEASE);
+    }
+    for (; parent != NULL; parent = rbtree_parent(parent)) {
+        parent->size++;
     }
+    insert_fixup(t, node);
 }
 
-void insert_case4(rbtree_t t, rbtree_node_t n) {
-    if (n == n->parent->right && n->parent == rbtree_grandparent(n)->left) {
-        rotate_left(t, n->parent);
-        n = n->left;
-    } else if (n == n->parent->left && n->parent == rbtree_grandparent(n)->right) {
-        rotate_right(t, n->parent);
-        n = n->right;
+int rbtree_insert(rbtree_t t, void *value, cmp_func compare) {
+    rbtree_node_t node;
+    rbtree_node_t n;
+    int result = 0;
+    if (t == NULL) {
+        t = rbtree_create();
+    }
+    if (t == NULL) {
+        return 0;
     }
-    insert_case5(t, n);
+    /* find the spot first, so a duplicate costs no allocation */
+    n = t->root;
+    while (n != NULL) {
+        result = compare(value, n->value);
+        if (result == 0) {
+            return -1;
+        }
+        else if (result < 0) {
+            if (n->left == NULL) {
+                break;
+            }
+            n = n->left;
+        }
+        else {
+            if (n->right == NULL) {
+                break;
+            }
+            n = n->right;
+        }
+    }
+    node = new_node(t, value, RED, NULL, NULL);
+    if (node == NULL) {
+        return 0;
+    }
+    link_node(t, node, n, result < 0);
+#ifdef RBTREE_DEBUG
+    return rbtree_verify_properties(t);
+#else
+    return -1;
+#endif
 }
 
-void insert_case3(rbtree_t t, rbtree_node_t n) {
-    if (rbtree_get_node_color(rbtree_uncle(n)) == RED) {
-        n->parent->color = BLACK;
-        rbtree_uncle(n)->color = BLACK;
-        rbtree_grandparent(n)->color = RED;
-        insert_case1(t, n);
+rbtree_node_t rbtree_insert_node(rbtree_t t, rbtree_node_t node, node_cmp_func compare) {
+    rbtree_node_t n = t->root;
+    int result = 0;
+    while (n != NULL) {
+        result = compare(node, n);
+        if (result == 0) {
+            return n;
+        }
+        else if (result < 0) {
+            if (n->left == NULL) {
+                break;
+            }
+            n = n->left;
+        }
+        else {
+            if (n->right == NULL) {
+                break;
+            }
+            n = n->right;
+        }
     }
-    else {
-        insert_case4(t, n);
+    link_node(t, node, n, result < 0);
+    return NULL;
+}
+
+rbtree_node_t rbtree_search_node(rbtree_t t, void *key, key_cmp_func compare) {
+    rbtree_node_t n = t->root;
+    while (n != NULL) {
+        int result = compare(key, n);
+        if (result == 0) {
+            return n;
+        }
+        else if (result < 0) {
+            n = n->left;
+        }
+        else {
+            n = n->right;
+        }
     }
+    return NULL;
 }
 
-void insert_case2(rbtree_t t, rbtree_node_t n) {
-    if (rbtree_get_node_color(n->parent) == BLACK) {
+/* Called with 'n' black, childless and still linked in, standing in for
+ * the black its removal takes off every path through it. A red sibling
+ * is rotated up first; then either the sibling turns red and the
+ * shortage moves up to the parent, or rotations at the parent borrow
+ * one of the sibling's red children and end it. */
+static void delete_fixup(rbtree_t t, rbtree_node_t n) {
+    rbtree_node_t parent, sibling;
+    while ((parent = rbtree_parent(n)) != NULL && rbtree_color(n) == BLACK) {
+        /* n's side is a black short, so the sibling exists */
+        if (n == parent->left) {
+            sibling = parent->right;
+            if (rbtree_color(sibling) == RED) {
+                set_color(sibling, BLACK);
+                set_color(parent, RED);
+                rotate_left(t, parent);
+                sibling = parent->right;
+            }
+            if (rbtree_get_node_color(sibling->left) == BLACK &&
+                rbtree_get_node_color(sibling->right) == BLACK) {
+                set_color(sibling, RED);
+                n = parent;
+                continue;
+            }
+            if (rbtree_get_node_color(sibling->right) == BLACK) {
+                set_color(sibling->left, BLACK);
+                set_color(sibling, RED);
+                rotate_right(t, sibling);
+                sibling = parent->right;
+            }
+            set_color(sibling, rbtree_color(parent));
+            set_color(parent, BLACK);
+            set_color(sibling->right, BLACK);
+            rotate_left(t, parent);
+        }
+        else {
+            sibling = parent->left;
+            if (rbtree_color(sibling) == RED) {
+                set_color(sibling, BLACK);
+                set_color(parent, RED);
+                rotate_right(t, parent);
+                sibling = parent->left;
+            }
+            if (rbtree_get_node_color(sibling->left) == BLACK &&
+                rbtree_get_node_color(sibling->right) == BLACK) {
+                set_color(sibling, RED);
+                n = parent;
+                continue;
+            }
+            if (rbtree_get_node_color(sibling->left) == BLACK) {
+                set_color(sibling->right, BLACK);
+                set_color(sibling, RED);
+                rotate_left(t, sibling);
+                sibling = parent->left;
+            }
+            set_color(sibling, rbtree_color(parent));
+            set_color(parent, BLACK);
+            set_color(sibling->left, BLACK);
+            rotate_right(t, parent);
+        }
         return;
     }
-    insert_case3(t, n);
+    /* reached the root, or a red node that absorbs the extra black */
+    set_color(n, BLACK);
 }
 
-void insert_case1(rbtree_t t, rbtree_node_t n) {
-    if (n->parent == NULL) {
-        n->color = BLACK;
+/* Trades places (and colors) of 'n' and its in-order predecessor 'p',
+ * relinking instead of copying values, since embedded nodes cannot move. */
+static void swap_with_predecessor(rbtree_t t, rbtree_node_t n, rbtree_node_t p) {
+    rbtree_node_t nparent = rbtree_parent(n);
+    rbtree_node_t nleft = n->left;
+    rbtree_node_t nright = n->right;
+    rbtree_node_t pleft = p->left;
+    rbtree_node_color color = rbtree_color(n);
+    unsigned int size = n->size;
+    set_color(n, rbtree_color(p));
+    set_color(p, color);
+    n->size = p->size;
+    p->size = size;
+    version_begin(t);
+    if (nparent == NULL) {
+        RBTREE_STORE(t->root, p);
+    }
+    else if (nparent->left == n) {
+        RBTREE_STORE(nparent->left, p);
     }
     else {
-        insert_case2(t, n);
+        RBTREE_STORE(nparent->right, p);
+    }
+    if (p == nleft) {
+        RBTREE_STORE(p->left, n);
+        set_parent(n, p);
     }
+    else {
+        /* p is a right child deeper down n's left subtree */
+        RBTREE_STORE(rbtree_parent(p)->right, n);
+        set_parent(n, rbtree_parent(p));
+        RBTREE_STORE(p->left, nleft);
+        set_parent(nleft, p);
+    }
+    set_parent(p, nparent);
+    RBTREE_STORE(p->right, nright);
+    if (nright != NULL) {
+        set_parent(nright, p);
+    }
+    RBTREE_STORE(n->left, pleft);
+    if (pleft != NULL) {
+        set_parent(pleft, n);
+    }
+    RBTREE_STORE(n->right, (rbtree_node_t)NULL);
+    version_end(t);
 }
 
-int rbtree_insert(rbtree_t t, void *value, cmp_func compare) {
-    rbtree_node_t node = new_node(value, RED, NULL, NULL);
-    if (node == NULL) {
-        return 0;
+void rbtree_remove_node(rbtree_t t, rbtree_node_t n) {
+    rbtree_node_t child;
+    if (n->left != NULL && n->right != NULL) {
+        swap_with_predecessor(t, n, rbtree_maximum_node(n->left));
     }
-    if (t == NULL) {
-        t = rbtree_create();
+    child = n->right == NULL? n->left : n->right;
+    if (rbtree_get_node_color(n) == BLACK) {
+        /* a red child just takes over the black; otherwise child is NULL
+         * and n, still in place, stands in for it while rebalancing */
+        if (rbtree_get_node_color(child) == RED) {
+            set_color(child, BLACK);
+        }
+        else {
+            delete_fixup(t, n);
+        }
     }
-    if (t == NULL) {
-        return 0;
+    /* a reader standing on n would climb out of it the wrong way */
+    version_begin(t);
+    rbtree_replace_node(t, n, child);
+    version_end(t);
+    for (child = rbtree_parent(n); child != NULL; child = rbtree_parent(child)) {
+        child->size--;
     }
-    if (t->root == NULL) {
-        t->root = node;
+}
+
+int rbtree_remove(rbtree_t t, void *value, cmp_func compare) {
+    rbtree_node_t n = lookup_node(t, value, compare);
+    if (n == NULL) {
+        return -1;
     }
-    else {
-        rbtree_node_t n = t->root;
-        while (1) {
-            int result = compare(value, n->value);
-            if (result == 0) {
-                free(node);
-                return -1;
-            }
-            else if (result < 0) {
-                if (n->left == NULL) {
-                    n->left = node;
-                    break;
-                }
-                else {
-                    n = n->left;
-                }
-            }
-            else {
-                if (n->right == NULL) {
-                    n->right = node;
-                    break;
-                }
-                else {
-                    n = n->right;
-                }
-            }
+    rbtree_remove_node(t, n);
+    free_node(t, n);
+#ifdef RBTREE_DEBUG
+    return rbtree_verify_properties(t);
+#else
+    return -1;
+#endif
+}
+
+unsigned int rbtree_count(rbtree_t t) {
+    return rbtree_get_node_size(t->root);
+}
+
+rbtree_node_t rbtree_first(rbtree_t t) {
+    rbtree_node_t n = t->root;
+    while (n != NULL && n->left != NULL) {
+        n = n->left;
+    }
+    return n;
+}
+
+rbtree_node_t rbtree_last(rbtree_t t) {
+    return rbtree_maximum_node(t->root);
+}
+
+rbtree_node_t rbtree_next(rbtree_node_t n) {
+    rbtree_node_t parent;
+    if (n->right != NULL) {
+        n = n->right;
+        while (n->left != NULL) {
+            n = n->left;
         }
-        node->parent = n;
+        return n;
     }
-    insert_case1(t, node);
-    return rbtree_verify_properties(t);
+    /* climb until we come up out of a left subtree */
+    while ((parent = rbtree_parent(n)) != NULL && n == parent->right) {
+        n = parent;
+    }
+    return parent;
 }
 
-void delete_case1(rbtree_t t, rbtree_node_t n);
-void delete_case2(rbtree_t t, rbtree_node_t n);
-void delete_case3(rbtree_t t, rbtree_node_t n);
-void delete_case4(rbtree_t t, rbtree_node_t n);
-void delete_case5(rbtree_t t, rbtree_node_t n);
-void delete_case6(rbtree_t t, rbtree_node_t n);
+rbtree_node_t rbtree_prev(rbtree_node_t n) {
+    rbtree_node_t parent;
+    if (n->left != NULL) {
+        return rbtree_maximum_node(n->left);
+    }
+    while ((parent = rbtree_parent(n)) != NULL && n == parent->left) {
+        n = parent;
+    }
+    return parent;
+}
 
-void delete_case1(rbtree_t t, rbtree_node_t n) {
-    if (n->parent == NULL)
-        return;
-    else
-        delete_case2(t, n);
+rbtree_node_t rbtree_lower_bound(rbtree_t t, void *value, cmp_func compare) {
+    rbtree_node_t n = t->root;
+    rbtree_node_t bound = NULL;
+    while (n != NULL) {
+        if (compare(value, n->value) <= 0) {
+            bound = n;
+            n = n->left;
+        }
+        else {
+            n = n->right;
+        }
+    }
+    return bound;
+}
+
+rbtree_node_t rbtree_upper_bound(rbtree_t t, void *value, cmp_func compare) {
+    rbtree_node_t n = t->root;
+    rbtree_node_t bound = NULL;
+    while (n != NULL) {
+        if (compare(value, n->value) < 0) {
+            bound = n;
+            n = n->left;
+        }
+        else {
+            n = n->right;
+        }
+    }
+    return bound;
+}
+
+unsigned int rbtree_rank(rbtree_t t, void *value, cmp_func compare) {
+    rbtree_node_t n = t->root;
+    unsigned int rank = 0;
+    while (n != NULL) {
+        if (compare(value, n->value) <= 0) {
+            n = n->left;
+        }
+        else {
+            rank += rbtree_get_node_size(n->left) + 1;
+            n = n->right;
+        }
+    }
+    return rank;
+}
+
+rbtree_node_t rbtree_select(rbtree_t t, unsigned int k) {
+    rbtree_node_t n = t->root;
+    unsigned int left;
+    while (n != NULL) {
+        left = rbtree_get_node_size(n->left);
+        if (k < left) {
+            n = n->left;
+        }
+        else if (k == left) {
+            return n;
+        }
+        else {
+            k -= left + 1;
+            n = n->right;
+        }
+    }
+    return NULL;
+}
+
+unsigned int rbtree_range(rbtree_t t, void *lo, void *hi, cmp_func compare, void (*fn)(void *ctx, void *value), void *ctx) {
+    rbtree_node_t n;
+    unsigned int count = 0;
+    for (n = rbtree_lower_bound(t, lo, compare); n != NULL && compare(n->value, hi) < 0; n = rbtree_next(n)) {
+        fn(ctx, n->value);
+        count++;
+    }
+    return count;
 }
 
-void delete_case2(rbtree_t t, rbtree_node_t n) {
-    if (rbtree_get_node_color(rbtree_sibling(n)) == RED) {
-        n->parent->color = RED;
-        rbtree_sibling(n)->color = BLACK;
-        if (n == n->parent->left)
-            rotate_left(t, n->parent);
-        else
-            rotate_right(t, n->parent);
+static void destroy_nodes(rbtree_t t, rbtree_node_t n) {
+    rbtree_node_t left;
+    /* walk down the left spine, recursing only into right subtrees */
+    while (n != NULL) {
+        left = n->left;
+        destroy_nodes(t, n->right);
+        free_node(t, n);
+        n = left;
     }
-    delete_case3(t, n);
 }
 
-void delete_case3(rbtree_t t, rbtree_node_t n) {
-    if (rbtree_get_node_color(n->parent) == BLACK &&
-        rbtree_get_node_color(rbtree_sibling(n)) == BLACK &&
-        rbtree_get_node_color(rbtree_sibling(n)->left) == BLACK &&
-        rbtree_get_node_color(rbtree_sibling(n)->right) == BLACK)
-    {
-        rbtree_sibling(n)->color = RED;
-        delete_case1(t, n->parent);
+void rbtree_destroy(rbtree_t t) {
+    rbtree_block *b;
+    if (t->flags & RBTREE_POOL) {
+        while ((b = t->blocks) != NULL) {
+            t->blocks = b->next;
+            free(b);
+        }
     }
-    else
-        delete_case4(t, n);
+    else if (!(t->flags & RBTREE_INTRUSIVE)) {
+        destroy_nodes(t, t->root);
+    }
+    free(t);
 }
 
-void delete_case4(rbtree_t t, rbtree_node_t n) {
-    if (rbtree_get_node_color(n->parent) == RED &&
-        rbtree_get_node_color(rbtree_sibling(n)) == BLACK &&
-        rbtree_get_node_color(rbtree_sibling(n)->left) == BLACK &&
-        rbtree_get_node_color(rbtree_sibling(n)->right) == BLACK)
-    {
-        rbtree_sibling(n)->color = RED;
-        n->parent->color = BLACK;
+/* Balanced tree over [lo, hi) of the sorted input. Splitting at the middle
+ * fills every level but the deepest, so coloring just that level red
+ * gives every path the same number of black nodes. */
+static rbtree_node_t build_sorted(rbtree_t t, void **values, rbtree_node_t *nodes, unsigned int lo, unsigned int hi, unsigned int depth, unsigned int reddepth, int *failed) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    rbtree_node_t n;
+    if (lo >= hi) {
+        return NULL;
     }
-    else
-        delete_case5(t, n);
+    n = nodes != NULL ? nodes[mid] : new_node(t, values[mid], BLACK, NULL, NULL);
+    if (n == NULL) {
+        *failed = 1;
+        return NULL;
+    }
+    set_parent_color(n, NULL, depth == reddepth ? RED : BLACK);
+    n->left = build_sorted(t, values, nodes, lo, mid, depth + 1, reddepth, failed);
+    n->right = build_sorted(t, values, nodes, mid + 1, hi, depth + 1, reddepth, failed);
+    if (n->left != NULL) {
+        set_parent(n->left, n);
+    }
+    if (n->right != NULL) {
+        set_parent(n->right, n);
+    }
+    n->size = hi - lo;
+    return n;
 }
 
-void delete_case5(rbtree_t t, rbtree_node_t n) {
-    if (n == n->parent->left &&
-        rbtree_get_node_color(rbtree_sibling(n)) == BLACK &&
-        rbtree_get_node_color(rbtree_sibling(n)->left) == RED &&
-        rbtree_get_node_color(rbtree_sibling(n)->right) == BLACK)
-    {
-        rbtree_sibling(n)->color = RED;
-        rbtree_sibling(n)->left->color = BLACK;
-        rotate_right(t, rbtree_sibling(n));
+static int load_sorted(rbtree_t t, void **values, rbtree_node_t *nodes, unsigned int count) {
+    unsigned int reddepth = 0;
+    int failed = 0;
+    if (t->root != NULL) {
+        return 0;
+    }
+    /* the first level that cannot be full, floor(log2(count + 1)) */
+    while (((count + 1ull) >> (reddepth + 1)) != 0) {
+        reddepth++;
     }
-    else if (n == n->parent->right &&
-             rbtree_get_node_color(rbtree_sibling(n)) == BLACK &&
-             rbtree_get_node_color(rbtree_sibling(n)->right) == RED &&
-             rbtree_get_node_color(rbtree_sibling(n)->left) == BLACK)
-    {
-        rbtree_sibling(n)->color = RED;
-        rbtree_sibling(n)->right->color = BLACK;
-        rotate_left(t, rbtree_sibling(n));
+    t->root = build_sorted(t, values, nodes, 0, count, 0, reddepth, &failed);
+    if (failed) {
+        destroy_nodes(t, t->root);
+        t->root = NULL;
+        return 0;
+    }
+    return -1;
+}
+
+int rbtree_load_sorted(rbtree_t t, void **values, unsigned int count) {
+    if (t->flags & RBTREE_INTRUSIVE) {
+        return 0;
     }
-    delete_case6(t, n);
+    return load_sorted(t, values, NULL, count);
+}
+
+int rbtree_load_sorted_nodes(rbtree_t t, rbtree_node_t *nodes, unsigned int count) {
+    return load_sorted(t, NULL, nodes, count);
 }
 
-void delete_case6(rbtree_t t, rbtree_node_t n) {
-    rbtree_sibling(n)->color = rbtree_get_node_color(n->parent);
-    n->parent->color = BLACK;
-    if (n == n->parent->left) {
-        if (rbtree_get_node_color(rbtree_sibling(n)->right) == RED) {
-            rbtree_sibling(n)->right->color = BLACK;
-            rotate_left(t, n->parent);
+/* black nodes on any path from n down to a leaf */
+static unsigned int black_height(rbtree_node_t n) {
+    unsigned int h = 0;
+    for (; n != NULL; n = n->left) {
+        if (rbtree_color(n) == BLACK) {
+            h++;
         }
     }
-    else
-    {
-        if (rbtree_get_node_color(rbtree_sibling(n)->left) == RED) {
-            rbtree_sibling(n)->left->color = BLACK;
-            rotate_right(t, n->parent);
+    return h;
+}
+
+/* cuts a subtree loose as a tree of its own; a black root keeps it valid */
+static rbtree_node_t detach_root(rbtree_node_t n) {
+    if (n != NULL) {
+        set_parent_color(n, NULL, BLACK);
+    }
+    return n;
+}
+
+/* Joins two standalone trees and a node k, with l < k < r. Walks down the
+ * taller tree's inner spine to the first black node of the shorter tree's
+ * black height, puts k there as a red node over it and the shorter tree,
+ * and repairs any red-red edge the way insertion does. O(log n). */
+static rbtree_node_t join_nodes(rbtree_node_t l, rbtree_node_t k, rbtree_node_t r) {
+    rbtree tmp;
+    rbtree_node_t c, p = NULL;
+    unsigned int hl = black_height(detach_root(l));
+    unsigned int hr = black_height(detach_root(r));
+    unsigned int h;
+    int right = hl >= hr;
+
+    tmp.version = 0;
+    tmp.root = right ? l : r;
+    c = tmp.root;
+    h = right ? hl : hr;
+    while (rbtree_get_node_color(c) != BLACK || h != (right ? hr : hl)) {
+        if (rbtree_color(c) == BLACK) {
+            h--;
         }
+        p = c;
+        c = right ? c->right : c->left;
+    }
+    set_parent_color(k, p, RED);
+    k->left = right ? c : l;
+    k->right = right ? r : c;
+    if (k->left != NULL) {
+        set_parent(k->left, k);
+    }
+    if (k->right != NULL) {
+        set_parent(k->right, k);
     }
+    k->size = 1 + rbtree_get_node_size(k->left) + rbtree_get_node_size(k->right);
+    if (p == NULL) {
+        tmp.root = k;
+    }
+    else if (right) {
+        p->right = k;
+    }
+    else {
+        p->left = k;
+    }
+    for (; p != NULL; p = rbtree_parent(p)) {
+        p->size += 1 + rbtree_get_node_size(right ? r : l);
+    }
+    insert_fixup(&tmp, k);
+    return tmp.root;
 }
 
-int rbtree_remove(rbtree_t t, void *value, cmp_func compare) {
-    rbtree_node_t child;
-    rbtree_node_t n = lookup_node(t, value, compare);
+/* Splits the tree at n into the values below and above 'value', returning
+ * the node equal to it (unlinked) or NULL. */
+static rbtree_node_t split_nodes(rbtree_node_t n, void *value, cmp_func compare, rbtree_node_t *l, rbtree_node_t *r) {
+    rbtree_node_t left, right, rest, found;
+    int result;
     if (n == NULL) {
-        return -1;
+        *l = NULL;
+        *r = NULL;
+        return NULL;
     }
-    if (n->left != NULL && n->right != NULL) {
-        rbtree_node_t pred = rbtree_maximum_node(n->left);
-        n->value = pred->value;
-        n = pred;
+    left = detach_root(n->left);
+    right = detach_root(n->right);
+    result = compare(value, n->value);
+    if (result == 0) {
+        *l = left;
+        *r = right;
+        return n;
     }
-    child = n->right == NULL? n->left : n->right;
-    if (rbtree_get_node_color(n) == BLACK) {
-        n->color = rbtree_get_node_color(child);
-        delete_case1(t, n);
+    else if (result < 0) {
+        found = split_nodes(left, value, compare, l, &rest);
+        *r = join_nodes(rest, n, right);
     }
-    rbtree_replace_node(t, n, child);
-    if (n->parent == NULL && child != NULL) {
-        child->color = BLACK;
+    else {
+        found = split_nodes(right, value, compare, &rest, r);
+        *l = join_nodes(left, n, rest);
     }
-    free(n);
-    return rbtree_verify_properties(t);
-}
\ No newline at end of file
+    return found;
+}
+
+/* a's root splits b, and the halves are merged on each side and joined
+ * back around it; O(m log(n/m + 1)) for trees of m <= n nodes. Of two
+ * equal nodes the one from b survives when 'keepb' is set. */
+static rbtree_node_t union_nodes(rbtree_t t, rbtree_node_t a, rbtree_node_t b, cmp_func compare, int keepb) {
+    rbtree_node_t left, right, l, r, dup;
+    if (a == NULL) {
+        return detach_root(b);
+    }
+    if (b == NULL) {
+        return detach_root(a);
+    }
+    left = detach_root(a->left);
+    right = detach_root(a->right);
+    dup = split_nodes(detach_root(b), a->value, compare, &l, &r);
+    if (dup != NULL && keepb) {
+        free_node(t, a);
+        a = dup;
+    }
+    else if (dup != NULL) {
+        free_node(t, dup);
+    }
+    l = union_nodes(t, left, l, compare, keepb);
+    r = union_nodes(t, right, r, compare, keepb);
+    return join_nodes(l, a, r);
+}
+
+int rbtree_union(rbtree_t t, rbtree_t other, cmp_func compare) {
+    rbtree_block *b;
+    rbtree_node_t n;
+    if (t->flags != other->flags || (t->flags & RBTREE_INTRUSIVE)) {
+        return 0;
+    }
+    if (t->flags & RBTREE_POOL) {
+        /* other's nodes stay where they are: adopt its blocks and freelist
+         * behind ours, so our newest block keeps being carved up */
+        if (t->blocks == NULL) {
+            t->blocks = other->blocks;
+            t->cursor = other->cursor;
+        }
+        else {
+            for (b = t->blocks; b->next != NULL; b = b->next);
+            b->next = other->blocks;
+        }
+        if (other->freelist != NULL) {
+            for (n = other->freelist; n->right != NULL; n = n->right);
+            n->right = t->freelist;
+            t->freelist = other->freelist;
+        }
+        other->blocks = NULL;
+        other->freelist = NULL;
+        other->cursor = 0;
+    }
+    /* the larger tree is split by the smaller one's nodes */
+    if (rbtree_count(t) >= rbtree_count(other)) {
+        t->root = union_nodes(t, other->root, t->root, compare, 1);
+    }
+    else {
+        t->root = union_nodes(t, t->root, other->root, compare, 0);
+    }
+    other->root = NULL;
+    return -1;
+}
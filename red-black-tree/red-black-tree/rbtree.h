@@ -12,6 +12,8 @@
 #ifndef red_black_tree_rbtree_h
 #define red_black_tree_rbtree_h
 
+#include <stddef.h>
+
 typedef enum {
     RED     = 0,
     BLACK   = 1
@@ -21,30 +23,116 @@ typedef struct rbtree_node {
     void *value;
     struct rbtree_node *left;
     struct rbtree_node *right;
-    struct rbtree_node *parent;
-    rbtree_node_color color;
+    unsigned long parent_color;     /* parent pointer, color in bit 0 */
+    unsigned int size;              /* nodes in this subtree, itself included */
 } rbtree_node;
 
+#define RBTREE_COLOR_MASK   1ul
+
+static inline rbtree_node *rbtree_parent(const rbtree_node *n) {
+    return (rbtree_node *)(n->parent_color & ~RBTREE_COLOR_MASK);
+}
+
+static inline rbtree_node_color rbtree_color(const rbtree_node *n) {
+    return (rbtree_node_color)(n->parent_color & RBTREE_COLOR_MASK);
+}
+
 typedef rbtree_node *rbtree_node_t;
 
+/* the struct holding an embedded rbtree_node, like Linux's rb_entry */
+#define rbtree_entry(node, type, member) \
+    ((type *)((char *)(node) - offsetof(type, member)))
+
+typedef enum {
+    RBTREE_MALLOC       = 0,        /* one malloc per node (default) */
+    RBTREE_POOL         = 1 << 0,   /* nodes come from blocks owned by the tree */
+    RBTREE_INTRUSIVE    = 1 << 1    /* callers embed the nodes; the tree never allocates */
+} rbtree_flags;
+
+/* pooled nodes come in blocks; freed ones are chained through 'right' */
+typedef struct rbtree_block {
+    struct rbtree_block *next;
+    unsigned int count;
+} rbtree_block;
+
 typedef struct {
     rbtree_node *root;
+    unsigned int flags;
+    rbtree_block *blocks;
+    rbtree_node *freelist;
+    unsigned int cursor;            /* nodes of the newest block handed out so far */
+    unsigned long version;          /* odd while a rotation moves nodes, see rbtree_concurrent.h */
 } rbtree;
 
 typedef rbtree *rbtree_t;
 
+#ifndef TREE_CMP_FUNC
+#define TREE_CMP_FUNC
 typedef int (*cmp_func)(void *left, void *right);
+#endif
+
+/* intrusive mode: order two embedded nodes, or a search key and a node */
+typedef int (*node_cmp_func)(rbtree_node_t left, rbtree_node_t right);
+typedef int (*key_cmp_func)(void *key, rbtree_node_t node);
 
 rbtree_t rbtree_create();
+rbtree_t rbtree_create_with_flags(unsigned int flags);
 void *rbtree_search(rbtree_t t, void *value, cmp_func compare);
 int rbtree_insert(rbtree_t t, void *value, cmp_func compare);
 int rbtree_remove(rbtree_t t, void *value, cmp_func compare);
 
+/* Order statistics and in-order cursors, all O(log n), plus O(1) for
+ * each step of a walk. A node is its own cursor: rbtree_next/prev follow
+ * parent pointers and return NULL past either end. Bounds, rank and
+ * range take the cmp_func the tree was built with. */
+unsigned int rbtree_count(rbtree_t t);
+rbtree_node_t rbtree_first(rbtree_t t);
+rbtree_node_t rbtree_last(rbtree_t t);
+rbtree_node_t rbtree_next(rbtree_node_t n);
+rbtree_node_t rbtree_prev(rbtree_node_t n);
+/* first node not less than 'value' / greater than 'value' */
+rbtree_node_t rbtree_lower_bound(rbtree_t t, void *value, cmp_func compare);
+rbtree_node_t rbtree_upper_bound(rbtree_t t, void *value, cmp_func compare);
+/* how many values are less than 'value' */
+unsigned int rbtree_rank(rbtree_t t, void *value, cmp_func compare);
+/* the k-th smallest node counting from 0, NULL when k >= rbtree_count */
+rbtree_node_t rbtree_select(rbtree_t t, unsigned int k);
+/* calls fn(ctx, value) for each value in [lo, hi) in order, returns how many */
+unsigned int rbtree_range(rbtree_t t, void *lo, void *hi, cmp_func compare, void (*fn)(void *ctx, void *value), void *ctx);
+
+/* Bulk operations. load_sorted builds an empty tree from 'count' strictly
+ * increasing values in O(n), no comparisons and no rebalancing;
+ * load_sorted_nodes does the same with embedded nodes. union moves every
+ * node of 'other' into 't' by split and join, O(m log(n/m + 1)) for the
+ * smaller tree's m, leaving 'other' empty; where both hold a value the
+ * one in 't' stays and other's node is freed. Both trees must have the
+ * same flags and not be RBTREE_INTRUSIVE. All return -1 on success. */
+int rbtree_load_sorted(rbtree_t t, void **values, unsigned int count);
+int rbtree_load_sorted_nodes(rbtree_t t, rbtree_node_t *nodes, unsigned int count);
+int rbtree_union(rbtree_t t, rbtree_t other, cmp_func compare);
+
+/* Walks the whole tree checking the red-black invariants; -1 if they
+ * hold. O(n), so insert and remove only call it when the library is
+ * built with -DRBTREE_DEBUG, and then return its result. */
+int rbtree_verify_properties(rbtree_t t);
+
+/* Frees the tree and, unless RBTREE_INTRUSIVE, its nodes. Values and
+ * embedded nodes belong to the caller. */
+void rbtree_destroy(rbtree_t t);
+
+/* Intrusive API: nodes live inside the caller's structs and their 'value'
+ * is unused. insert_node links 'node' in and returns NULL, or returns the
+ * node already holding an equal key and leaves 'node' alone. */
+rbtree_node_t rbtree_insert_node(rbtree_t t, rbtree_node_t node, node_cmp_func compare);
+rbtree_node_t rbtree_search_node(rbtree_t t, void *key, key_cmp_func compare);
+/* unlinks a node that is in the tree; nothing is freed */
+void rbtree_remove_node(rbtree_t t, rbtree_node_t node);
+
 rbtree_node_t rbtree_grandparent(rbtree_node_t n);
 rbtree_node_t rbtree_sibling(rbtree_node_t n);
 rbtree_node_t rbtree_uncle(rbtree_node_t n);
-int rbtree_verify_properties(rbtree_t t);
 rbtree_node_color rbtree_get_node_color(rbtree_node_t n);
+unsigned int rbtree_get_node_size(rbtree_node_t n);
 void rbtree_replace_node(rbtree_t t, rbtree_node_t oldn, rbtree_node_t newn);
 rbtree_node_t rbtree_maximum_node(rbtree_node_t n);
 
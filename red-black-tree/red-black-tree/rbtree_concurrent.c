@@ -0,0 +1,232 @@
+//
+//  rbtree_concurrent.c
+//  red-black-tree
+//
+//  Single-lock writers, version validated lock-free readers, see
+//  rbtree_concurrent.h.
+//
+
+#include <stdlib.h>
+#include <sched.h>
+#include "rbtree_concurrent.h"
+
+#define CRBTREE_MAX_DEPTH       128     /* deeper than any valid tree, so a walk gone astray stops */
+#define CRBTREE_RECLAIM_BATCH   64      /* retirements between reclaim attempts */
+
+#define CRBTREE_LOAD(p)         __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+crbtree* crbtree_create(cmp_func compare, void (*release)(void *value)) {
+    crbtree *c;
+    if (posix_memalign((void **)&c, CRBTREE_CACHE_LINE, sizeof(crbtree)) != 0) {
+        return NULL;
+    }
+    c->tree = rbtree_create_with_flags(RBTREE_MALLOC);
+    if (c->tree == NULL) {
+        free(c);
+        return NULL;
+    }
+    c->compare = compare;
+    c->release = release;
+    pthread_mutex_init(&c->lock, NULL);
+    epoch_init(&c->readers, CRBTREE_RECLAIM_BATCH);
+    return c;
+}
+
+void crbtree_pin(crbtree *c) {
+    epoch_pin(&c->readers);
+}
+
+void crbtree_unpin(crbtree *c) {
+    epoch_unpin(&c->readers);
+}
+
+/* epoch_free_fn for a removed node */
+static void crbtree_free_node(void *ctx, void *ptr) {
+    crbtree *c = (crbtree *)ctx;
+    rbtree_node_t n = (rbtree_node_t)ptr;
+    if (c->release != NULL) {
+        c->release(n->value);
+    }
+    free(n);
+}
+
+/* an even version to validate against; waits out a rotation in progress */
+static unsigned long crbtree_read_begin(crbtree *c) {
+    unsigned long version;
+    while ((version = __atomic_load_n(&c->tree->version, __ATOMIC_ACQUIRE)) & 1) {
+        sched_yield();
+    }
+    return version;
+}
+
+/* non-zero when no node moved since crbtree_read_begin returned 'version' */
+static int crbtree_read_validate(crbtree *c, unsigned long version) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&c->tree->version, __ATOMIC_RELAXED) == version;
+}
+
+/* first node not below 'value' (above it when 'strict'); 0 if the walk
+ * ran too deep, which only a concurrent rotation can cause */
+static int crbtree_bound(crbtree *c, void *value, int strict, rbtree_node_t *bound) {
+    rbtree_node_t n = CRBTREE_LOAD(c->tree->root);
+    unsigned int steps = 0;
+    int result;
+    *bound = NULL;
+    while (n != NULL) {
+        if (++steps > CRBTREE_MAX_DEPTH) {
+            return 0;
+        }
+        result = c->compare(value, n->value);
+        if (result < 0 || (result == 0 && !strict)) {
+            *bound = n;
+            n = CRBTREE_LOAD(n->left);
+        }
+        else {
+            n = CRBTREE_LOAD(n->right);
+        }
+    }
+    return -1;
+}
+
+/* rbtree_next with checked loads and a bounded walk */
+static int crbtree_next(rbtree_node_t n, rbtree_node_t *next) {
+    rbtree_node_t m = CRBTREE_LOAD(n->right);
+    unsigned int steps = 0;
+    if (m != NULL) {
+        while ((n = CRBTREE_LOAD(m->left)) != NULL) {
+            if (++steps > CRBTREE_MAX_DEPTH) {
+                return 0;
+            }
+            m = n;
+        }
+        *next = m;
+        return -1;
+    }
+    while ((m = (rbtree_node_t)(CRBTREE_LOAD(n->parent_color) & ~RBTREE_COLOR_MASK)) != NULL &&
+           n == CRBTREE_LOAD(m->right)) {
+        if (++steps > CRBTREE_MAX_DEPTH) {
+            return 0;
+        }
+        n = m;
+    }
+    *next = m;
+    return -1;
+}
+
+int crbtree_insert(crbtree *c, void *value) {
+    int result;
+    pthread_mutex_lock(&c->lock);
+    result = rbtree_insert(c->tree, value, c->compare);
+    pthread_mutex_unlock(&c->lock);
+    return result;
+}
+
+int crbtree_remove(crbtree *c, void *value) {
+    rbtree_node_t n;
+    pthread_mutex_lock(&c->lock);
+    n = rbtree_lower_bound(c->tree, value, c->compare);
+    if (n == NULL || c->compare(value, n->value) != 0) {
+        pthread_mutex_unlock(&c->lock);
+        return 0;
+    }
+    rbtree_remove_node(c->tree, n);
+    pthread_mutex_unlock(&c->lock);
+    epoch_retire(&c->readers, n, crbtree_free_node, c);
+    return -1;
+}
+
+void* crbtree_search(crbtree *c, void *value) {
+    rbtree_node_t n;
+    void *found;
+    unsigned long version;
+    unsigned int tries, steps;
+    int result;
+    crbtree_pin(c);
+    for (tries = 0; tries < CRBTREE_OPTIMISTIC_TRIES; tries++) {
+        version = crbtree_read_begin(c);
+        n = CRBTREE_LOAD(c->tree->root);
+        found = NULL;
+        for (steps = 0; n != NULL && steps < CRBTREE_MAX_DEPTH; steps++) {
+            result = c->compare(value, n->value);
+            if (result == 0) {
+                found = n->value;
+                break;
+            }
+            n = result < 0 ? CRBTREE_LOAD(n->left) : CRBTREE_LOAD(n->right);
+        }
+        if (steps < CRBTREE_MAX_DEPTH && crbtree_read_validate(c, version)) {
+            crbtree_unpin(c);
+            return found;
+        }
+    }
+    /* writers keep moving nodes under us: queue up behind them */
+    pthread_mutex_lock(&c->lock);
+    found = rbtree_search(c->tree, value, c->compare);
+    pthread_mutex_unlock(&c->lock);
+    crbtree_unpin(c);
+    return found;
+}
+
+unsigned int crbtree_range(crbtree *c, void *lo, void *hi, void (*fn)(void *ctx, void *value), void *ctx) {
+    rbtree_node_t n;
+    void *last = NULL;
+    unsigned long version;
+    unsigned int tries, count = 0;
+    int started = 0, done = 0;
+    crbtree_pin(c);
+    for (tries = 0; !done && tries < CRBTREE_OPTIMISTIC_TRIES; tries++) {
+        version = crbtree_read_begin(c);
+        /* (re)start just after the last value handed to fn */
+        if (!crbtree_bound(c, started ? last : lo, started, &n)) {
+            continue;
+        }
+        while (1) {
+            if (n == NULL || c->compare(n->value, hi) >= 0) {
+                done = crbtree_read_validate(c, version);
+                break;
+            }
+            if (!crbtree_read_validate(c, version)) {
+                break;
+            }
+            fn(ctx, n->value);
+            count++;
+            last = n->value;
+            started = 1;
+            if (!crbtree_next(n, &n)) {
+                break;
+            }
+        }
+    }
+    if (!done) {
+        pthread_mutex_lock(&c->lock);
+        n = started ? rbtree_upper_bound(c->tree, last, c->compare) : rbtree_lower_bound(c->tree, lo, c->compare);
+        for (; n != NULL && c->compare(n->value, hi) < 0; n = rbtree_next(n)) {
+            fn(ctx, n->value);
+            count++;
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+    crbtree_unpin(c);
+    return count;
+}
+
+unsigned int crbtree_count(crbtree *c) {
+    unsigned int count;
+    pthread_mutex_lock(&c->lock);
+    count = rbtree_count(c->tree);
+    pthread_mutex_unlock(&c->lock);
+    return count;
+}
+
+void crbtree_destroy(crbtree *c) {
+    rbtree_node_t n;
+    if (c->release != NULL) {
+        for (n = rbtree_first(c->tree); n != NULL; n = rbtree_next(n)) {
+            c->release(n->value);
+        }
+    }
+    epoch_destroy(&c->readers);
+    rbtree_destroy(c->tree);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
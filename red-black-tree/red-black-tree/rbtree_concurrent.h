@@ -0,0 +1,61 @@
+//
+//  rbtree_concurrent.h
+//  red-black-tree
+//
+//  Read-mostly thread-safe red-black tree over a plain rbtree. Writers
+//  serialize on one lock; readers take no lock. Every rotation bumps the
+//  tree's version to odd and back (see rbtree.h), so a reader walks the
+//  parent-linked nodes optimistically and retries when the version moved
+//  underneath it. After CRBTREE_OPTIMISTIC_TRIES failed walks a reader
+//  falls back to the lock. Removed nodes are freed, and their values
+//  released, only once every reader that could still see them has left
+//  its epoch (see common/epoch.h).
+//
+
+#ifndef red_black_tree_rbtree_concurrent_h
+#define red_black_tree_rbtree_concurrent_h
+
+#include <pthread.h>
+#include "rbtree.h"
+#include "../../common/epoch.h"
+
+#define CRBTREE_CACHE_LINE          64
+#define CRBTREE_OPTIMISTIC_TRIES    8
+
+typedef struct {
+    rbtree_t tree;                      /* RBTREE_MALLOC, written under 'lock' only */
+    cmp_func compare;
+    void (*release)(void *value);       /* for removed values, may be NULL */
+    pthread_mutex_t lock;
+    epoch_domain readers;               /* and the removed nodes */
+} crbtree;
+
+crbtree* crbtree_create(cmp_func compare, void (*release)(void *value));
+
+/* -1 when inserted or already present, 0 when out of memory */
+int crbtree_insert(crbtree *c, void *value);
+
+/* -1 when removed, 0 when absent; the stored value goes to 'release'
+ * after the grace period */
+int crbtree_remove(crbtree *c, void *value);
+
+/* the stored value equal to 'value', or NULL; it stays alive only while
+ * the calling thread holds crbtree_pin() */
+void* crbtree_search(crbtree *c, void *value);
+
+/* Calls fn(ctx, value) in order for values in [lo, hi), pinned, and
+ * returns how many. Each value was in the tree when it was visited; a
+ * scan that races a rotation resumes after the last value it reported. */
+unsigned int crbtree_range(crbtree *c, void *lo, void *hi, void (*fn)(void *ctx, void *value), void *ctx);
+
+unsigned int crbtree_count(crbtree *c);
+
+/* keep everything read until the matching unpin alive; pins nest */
+void crbtree_pin(crbtree *c);
+
+void crbtree_unpin(crbtree *c);
+
+/* no other thread may use the tree any more; releases every value */
+void crbtree_destroy(crbtree *c);
+
+#endif
@@ -0,0 +1,225 @@
+//
+//  main.c
+//  splay-tree
+//
+//  Lookups drawn from a Zipf distribution, and from a uniform one for
+//  contrast, against the splay tree, the red-black tree and the AVL tree.
+//  rbtree.c is built from its own project directory; the AVL tree comes
+//  from the avltree library of the AVL-tree project.
+//
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include "splay_tree.h"
+#include "../../red-black-tree/red-black-tree/rbtree.h"
+#include "../../AVL-tree/AVL-tree/avl_tree.h"
+#include "../../common/bench.h"
+
+#define DEFAULT_KEY_COUNT   1000000
+#define LOOKUPS_PER_KEY     4
+#define ZIPF_EXPONENT       1.1     /* about 90% of lookups go to 5% of 1M keys */
+#define HOT_FRACTION        0.05
+#define RANK_SEED           2685821657736338717ull
+
+enum { RBTREE, AVL_TREE, SPLAY_TREE, TREE_KINDS };
+
+const char *tree_names[TREE_KINDS] = { "rbtree", "avl", "splay" };
+
+unsigned long long comparisons = 0;
+
+int counting_cmp(void *left, void *right);
+int *make_zipf_probes(int *ranked, unsigned int count, unsigned int lookups, double exponent, double *hot_share);
+int *make_uniform_probes(int *keys, unsigned int count, unsigned int lookups);
+void bench_tree(int kind, int *keys, unsigned int count, int *probes, unsigned int lookups, int *hot, unsigned int hotcount);
+void bench_lookups(const char *name, int zipf, unsigned int count);
+
+/* bench_int_cmp that also counts its calls in 'comparisons' */
+int counting_cmp(void *left, void *right) {
+    comparisons++;
+    return bench_int_cmp(left, right);
+}
+
+/* ranked[r] is drawn with probability proportional to 1 / (r + 1)^exponent.
+ * 'ranked' is a permutation of its own, unrelated to the insertion order,
+ * so the hot keys are neither the first inserted (and near the top of a
+ * balanced tree) nor bunched at one end of the key space. 'hot_share'
+ * gets the fraction of draws that fell on the top HOT_FRACTION of ranks. */
+int *make_zipf_probes(int *ranked, unsigned int count, unsigned int lookups, double exponent, double *hot_share) {
+    int *probes = (int *)malloc(sizeof(int) * lookups);
+    double *cdf = (double *)malloc(sizeof(double) * count);
+    unsigned long long x = 0x9e3779b97f4a7c15ull;
+    unsigned int i, lo, hi, mid, hot = 0, hotcount = (unsigned int)(count * HOT_FRACTION);
+    double sum = 0, u;
+    if (probes == NULL || cdf == NULL) {
+        free(probes);
+        free(cdf);
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        sum += 1.0 / pow(i + 1.0, exponent);
+        cdf[i] = sum;
+    }
+    for (i = 0; i < lookups; i++) {
+        u = (bench_random(&x) >> 11) * (1.0 / 9007199254740992.0) * sum;
+        // first rank whose cumulative weight exceeds u
+        for (lo = 0, hi = count - 1; lo < hi; ) {
+            mid = lo + (hi - lo) / 2;
+            if (cdf[mid] <= u) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        probes[i] = ranked[lo];
+        hot += lo < hotcount;
+    }
+    free(cdf);
+    *hot_share = (double)hot / lookups;
+    return probes;
+}
+
+int *make_uniform_probes(int *keys, unsigned int count, unsigned int lookups) {
+    int *probes = (int *)malloc(sizeof(int) * lookups);
+    unsigned long long x = 0x9e3779b97f4a7c15ull;
+    unsigned int i;
+    if (probes == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < lookups; i++) {
+        probes[i] = keys[bench_random(&x) % count];
+    }
+    return probes;
+}
+
+/* Inserts 'keys' in their shuffled order, then times the lookups. The
+ * lookups go through counting_cmp, the same small cost for every tree, so
+ * the comparisons reported are those of the timed run. For the splay tree
+ * it also reports how deep the hottest keys ended up. */
+void bench_tree(int kind, int *keys, unsigned int count, int *probes, unsigned int lookups, int *hot, unsigned int hotcount) {
+    rbtree_t rb = NULL;
+    avl_tree_t avl = NULL;
+    splay_tree_t splay = NULL;
+    unsigned int i, found = 0;
+    double start, insert_ns, lookup_ns, per_lookup, depth = 0;
+
+    if ((kind == RBTREE && (rb = rbtree_create()) == NULL) ||
+        (kind == AVL_TREE && (avl = avl_tree_create()) == NULL) ||
+        (kind == SPLAY_TREE && (splay = splay_tree_create()) == NULL)) {
+        return;
+    }
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (kind == RBTREE) {
+            rbtree_insert(rb, &keys[i], bench_int_cmp);
+        }
+        else if (kind == AVL_TREE) {
+            avl_tree_insert(avl, &keys[i], bench_int_cmp);
+        }
+        else {
+            splay_tree_insert(splay, &keys[i], bench_int_cmp);
+        }
+    }
+    insert_ns = (bench_now_ns() - start) / count;
+
+    comparisons = 0;
+    start = bench_now_ns();
+    if (kind == RBTREE) {
+        for (i = 0; i < lookups; i++) {
+            found += rbtree_search(rb, &probes[i], counting_cmp) != NULL;
+        }
+    }
+    else if (kind == AVL_TREE) {
+        for (i = 0; i < lookups; i++) {
+            found += avl_tree_lookup(avl, &probes[i], counting_cmp) != NULL;
+        }
+    }
+    else {
+        for (i = 0; i < lookups; i++) {
+            found += splay_tree_search(splay, &probes[i], counting_cmp) != NULL;
+        }
+    }
+    lookup_ns = (bench_now_ns() - start) / lookups;
+    per_lookup = (double)comparisons / lookups;
+
+    if (kind == SPLAY_TREE && hotcount > 0) {
+        for (i = 0; i < hotcount; i++) {
+            depth += splay_tree_depth(splay, &hot[i], bench_int_cmp);
+        }
+        printf("  %-8s insert %6.1f ns/op  lookup %6.1f ns/op  %5.1f cmp/lookup  (%u/%u found, hot keys at mean depth %.1f)\n",
+               tree_names[kind], insert_ns, lookup_ns, per_lookup, found, lookups, depth / hotcount);
+    }
+    else {
+        printf("  %-8s insert %6.1f ns/op  lookup %6.1f ns/op  %5.1f cmp/lookup  (%u/%u found)\n",
+               tree_names[kind], insert_ns, lookup_ns, per_lookup, found, lookups);
+    }
+
+    if (rb != NULL) {
+        rbtree_destroy(rb);
+    }
+    if (avl != NULL) {
+        avl_tree_destroy(avl);
+    }
+    if (splay != NULL) {
+        splay_tree_destroy(splay);
+    }
+}
+
+void bench_lookups(const char *name, int zipf, unsigned int count) {
+    unsigned int lookups = count * LOOKUPS_PER_KEY, hotcount = 0;
+    int *keys, *ranked = NULL, *probes = NULL, kind;
+    double hot_share;
+
+    if ((keys = bench_keys(count, BENCH_KEY_SEED)) == NULL) {
+        return;
+    }
+    if (zipf) {
+        if ((ranked = bench_keys(count, RANK_SEED)) != NULL) {
+            probes = make_zipf_probes(ranked, count, lookups, ZIPF_EXPONENT, &hot_share);
+        }
+        hotcount = (unsigned int)(count * HOT_FRACTION);
+    }
+    else {
+        probes = make_uniform_probes(keys, count, lookups);
+    }
+    if (probes == NULL) {
+        free(ranked);
+        free(keys);
+        return;
+    }
+    if (zipf) {
+        printf("%s: %u keys, %u lookups, exponent %.2f, %.1f%% of them on the hottest %.0f%% of keys\n",
+               name, count, lookups, ZIPF_EXPONENT, hot_share * 100, HOT_FRACTION * 100);
+    }
+    else {
+        printf("%s: %u keys, %u lookups\n", name, count, lookups);
+    }
+    for (kind = 0; kind < TREE_KINDS; kind++) {
+        bench_tree(kind, keys, count, probes, lookups, ranked, hotcount);
+    }
+    free(probes);
+    free(ranked);
+    free(keys);
+}
+
+int main (int argc, const char * argv[])
+{
+    const char *bench = argc > 1 ? argv[1] : "all";
+    unsigned int count = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : DEFAULT_KEY_COUNT;
+    int all = strcmp(bench, "all") == 0;
+    if (count == 0) {
+        fprintf(stderr, "usage: splay-tree [all|zipf|uniform] [keys]\n");
+        return 1;
+    }
+
+    printf("splay tree...!\n");
+    if (all || strcmp(bench, "zipf") == 0) {
+        bench_lookups("zipf", 1, count);
+    }
+    if (all || strcmp(bench, "uniform") == 0) {
+        bench_lookups("uniform", 0, count);
+    }
+    return 0;
+}
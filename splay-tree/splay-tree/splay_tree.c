@@ -0,0 +1,192 @@
+//
+//  splay_tree.c
+//  splay-tree
+//
+//  Top-down splaying, see splay_tree.h.
+//
+
+#include <stdlib.h>
+#include "splay_tree.h"
+
+/* Splays the node closest to 'value' to the root of the subtree 'n',
+ * returns it and leaves compare(value, its value) in *last. On the way
+ * down, nodes greater than 'value' are hung off the left end of a right
+ * tree and smaller ones off the right end of a left tree; a zig-zig
+ * rotates first, which is what halves the depth of the path. At the end
+ * both trees become the new root's children. Each node on the path is
+ * compared once. */
+static splay_node_t splay(splay_node_t n, void *value, cmp_func compare, int *last) {
+    splay_node header, *l = &header, *r = &header, *y;
+    int c;
+    if (n == NULL) {
+        return NULL;
+    }
+    header.left = header.right = NULL;
+    c = compare(value, n->value);
+    for (;;) {
+        if (c < 0) {
+            if (n->left == NULL) {
+                break;
+            }
+            if ((c = compare(value, n->left->value)) < 0) {
+                y = n->left;            // rotate right
+                n->left = y->right;
+                y->right = n;
+                n = y;
+                if (n->left == NULL) {
+                    break;
+                }
+                r->left = n;            // link right
+                r = n;
+                n = n->left;
+                c = compare(value, n->value);
+            }
+            else {
+                r->left = n;            // link right, the child is compared
+                r = n;
+                n = n->left;
+            }
+        }
+        else if (c > 0) {
+            if (n->right == NULL) {
+                break;
+            }
+            if ((c = compare(value, n->right->value)) > 0) {
+                y = n->right;           // rotate left
+                n->right = y->left;
+                y->left = n;
+                n = y;
+                if (n->right == NULL) {
+                    break;
+                }
+                l->right = n;           // link left
+                l = n;
+                n = n->right;
+                c = compare(value, n->value);
+            }
+            else {
+                l->right = n;           // link left, the child is compared
+                l = n;
+                n = n->right;
+            }
+        }
+        else {
+            break;
+        }
+    }
+    l->right = n->left;
+    r->left = n->right;
+    n->left = header.right;
+    n->right = header.left;
+    *last = c;
+    return n;
+}
+
+splay_tree_t splay_tree_create(void) {
+    splay_tree_t t = (splay_tree_t)malloc(sizeof(splay_tree));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->root = NULL;
+    t->count = 0;
+    return t;
+}
+
+void *splay_tree_search(splay_tree_t t, void *value, cmp_func compare) {
+    int c;
+    t->root = splay(t->root, value, compare, &c);
+    if (t->root != NULL && c == 0) {
+        return t->root->value;
+    }
+    return NULL;
+}
+
+int splay_tree_insert(splay_tree_t t, void *value, cmp_func compare) {
+    splay_node_t n;
+    int c = 0;
+    if (t->root != NULL) {
+        t->root = splay(t->root, value, compare, &c);
+        if (c == 0) {
+            return -1;
+        }
+    }
+    if ((n = (splay_node_t)malloc(sizeof(splay_node))) == NULL) {
+        return 0;
+    }
+    n->value = value;
+    if (t->root == NULL) {
+        n->left = n->right = NULL;
+    }
+    else if (c < 0) {
+        n->left = t->root->left;
+        n->right = t->root;
+        t->root->left = NULL;
+    }
+    else {
+        n->right = t->root->right;
+        n->left = t->root;
+        t->root->right = NULL;
+    }
+    t->root = n;
+    t->count++;
+    return -1;
+}
+
+int splay_tree_remove(splay_tree_t t, void *value, cmp_func compare) {
+    splay_node_t n;
+    int c;
+    t->root = splay(t->root, value, compare, &c);
+    if (t->root == NULL || c != 0) {
+        return 0;
+    }
+    n = t->root;
+    if (n->left == NULL) {
+        t->root = n->right;
+    }
+    else {
+        // everything on the left is smaller, so this brings its maximum
+        // up, which has no right child
+        t->root = splay(n->left, value, compare, &c);
+        t->root->right = n->right;
+    }
+    free(n);
+    t->count--;
+    return -1;
+}
+
+unsigned int splay_tree_count(splay_tree_t t) {
+    return t->count;
+}
+
+int splay_tree_depth(splay_tree_t t, void *value, cmp_func compare) {
+    splay_node_t n = t->root;
+    int c, depth = 0;
+    while (n != NULL) {
+        if ((c = compare(value, n->value)) == 0) {
+            return depth;
+        }
+        n = c < 0 ? n->left : n->right;
+        depth++;
+    }
+    return -1;
+}
+
+void splay_tree_destroy(splay_tree_t t) {
+    splay_node_t n = t->root, y;
+    // the tree can be a long path, so rotate left children up instead
+    // of recursing
+    while (n != NULL) {
+        if (n->left != NULL) {
+            y = n->left;
+            n->left = y->right;
+            y->right = n;
+            n = y;
+        }
+        else {
+            y = n->right;
+            free(n);
+            n = y;
+        }
+    }
+    free(t);
+}
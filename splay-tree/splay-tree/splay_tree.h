@@ -0,0 +1,61 @@
+//
+//  splay_tree.h
+//  splay-tree
+//
+//  Self-adjusting binary search tree (Sleator and Tarjan). Every search,
+//  insert and remove splays the key it touched to the root, top-down in a
+//  single pass, so keys used often stay a few links from the root and a
+//  skewed lookup mix costs far less than log n per lookup. Any sequence of
+//  m operations is O(m log n) in total; a single one may be O(n).
+//
+//  Nodes carry no parent pointer and no balance field. Even lookups change
+//  the shape of the tree, so all calls need exclusive access.
+//
+
+#ifndef splay_tree_splay_tree_h
+#define splay_tree_splay_tree_h
+
+typedef struct splay_node {
+    void *value;
+    struct splay_node *left;
+    struct splay_node *right;
+} splay_node;
+
+typedef splay_node *splay_node_t;
+
+typedef struct {
+    splay_node_t root;
+    unsigned int count;
+} splay_tree;
+
+typedef splay_tree *splay_tree_t;
+
+/* the same comparator as rbtree.h and avl_tree.h, so all three headers
+ * can be included together */
+#ifndef TREE_CMP_FUNC
+#define TREE_CMP_FUNC
+typedef int (*cmp_func)(void *left, void *right);
+#endif
+
+splay_tree_t splay_tree_create(void);
+
+/* the stored value equal to 'value', or NULL; either way the last node
+ * visited becomes the root */
+void *splay_tree_search(splay_tree_t t, void *value, cmp_func compare);
+
+/* -1 when inserted or already present, 0 when out of memory */
+int splay_tree_insert(splay_tree_t t, void *value, cmp_func compare);
+
+/* -1 when removed, 0 when absent */
+int splay_tree_remove(splay_tree_t t, void *value, cmp_func compare);
+
+unsigned int splay_tree_count(splay_tree_t t);
+
+/* depth of 'value' below the root, 0 for the root itself, -1 if absent;
+ * does not splay */
+int splay_tree_depth(splay_tree_t t, void *value, cmp_func compare);
+
+/* frees the tree and its nodes, not the values */
+void splay_tree_destroy(splay_tree_t t);
+
+#endif